@@ -64,6 +64,56 @@ public:
 
             ("verbose,v", boost::program_options::value<int>()->implicit_value(4),
                   "select verbosity level (0 = QUIET, 1 = FATAL, 2 = ERROR, 3 = WARNING, 4 = INFO 5 = DEBUG0 6 = DEBUG1)")
+
+            ("shards", boost::program_options::value<uint32_t>(), "number of sender threads (one per core), default 1")
+
+            ("cpus", boost::program_options::value<std::string>(), "comma separated list of CPUs to pin the sender threads to")
+
+            ("burst-period", boost::program_options::value<uint32_t>(), "period between sent bursts in microseconds, default 4000")
+
+            ("backend", boost::program_options::value<std::string>(), "egress backend {socket | io-uring | packet-mmap | af-xdp}, default socket")
+
+            ("interface", boost::program_options::value<std::string>(), "output network interface of the packet-mmap and af-xdp backends")
+
+            ("xdp-queue", boost::program_options::value<uint32_t>(), "first interface queue used by the af-xdp backend, default 0")
+
+            ("txtime", "kernel scheduled transmission (SO_TXTIME), requires fq or etf qdisc on the output interface")
+
+            ("gso", "send same destination datagram runs with UDP GSO (UDP_SEGMENT)")
+
+            ("pacing", "spread every burst along the burst period at the datagrams send times")
+
+            ("peak-rate", boost::program_options::value<double>(), "max aggregated output rate in Mbps")
+
+            ("stream-peak-rate", boost::program_options::value<double>(), "max output rate of every stream in Mbps")
+
+            ("connect", "send through a connected UDP socket per destination")
+
+            ("zerocopy", "send with MSG_ZEROCOPY, best combined with --gso")
+
+            ("max-drift-ppm", boost::program_options::value<uint32_t>(), "max slew rate of the streams drift control (e.g. 100), default 0 disabled")
+
+            ("late-policy", boost::program_options::value<std::string>(), "policy for the late datagrams {catch-up|drop|resync}, default catch-up")
+
+            ("late-threshold", boost::program_options::value<uint32_t>(), "lateness (ms) that triggers the drop and resync policies, default 100")
+
+            ("catchup-overspeed", boost::program_options::value<double>(), "max rate of the late datagrams relative to the stream bitrate (e.g. 1.2), default unbounded")
+
+            ("timestamps", boost::program_options::value<std::string>(), "play streams packets timing {bitrate|pcr}, pcr follows the PCRs of VBR files, default bitrate")
+
+            ("pcr-restamp", "rewrite the PCRs with the actual departure time of the datagrams")
+
+            ("fec", boost::program_options::value<std::string>(), "SMPTE 2022-1 FEC LxD (e.g. 10x10) sent to port+2 (columns) and port+4 (rows), RTP encapsulates the media")
+
+            ("path2", boost::program_options::value<std::string>(), "play streams SMPTE 2022-7 secondary path target ip")
+
+            ("path2-port-offset", boost::program_options::value<uint16_t>(), "play streams secondary path port, relative to the primary one, default 0")
+
+            ("path-skew", boost::program_options::value<uint32_t>(), "delay (us) of the SMPTE 2022-7 secondary path, default 0")
+
+            ("read-buffer-mb", boost::program_options::value<uint32_t>(), "play streams memory ceiling (MB) of the file read buffers, default 3 seconds of stream")
+
+            ("hugepages", "play streams file read buffers backed by huge pages")
         ;
 
         boost::program_options::positional_options_description p;
@@ -76,7 +126,7 @@ public:
         boost::program_options::store(parsed, vm);
 
         if (vm.count("help") || argc == 1) {
-            std::cout << "Usage:" << std::endl << std::endl << "ipcaster [-v] [-l] [-h] [service {service_args} | play {play_args}}" << std::endl << std::endl;
+            std::cout << "Usage:" << std::endl << std::endl << "ipcaster [-v] [-l] [-h] [--shards n] [--cpus list] [--burst-period us] [--backend name] [--interface name] [--xdp-queue n] [--txtime] [--gso] [--pacing] [--peak-rate Mbps] [--stream-peak-rate Mbps] [--connect] [--zerocopy] [--max-drift-ppm ppm] [--late-policy name] [--late-threshold ms] [--catchup-overspeed factor] [--timestamps mode] [--pcr-restamp] [--fec LxD] [--path2 ip] [--path2-port-offset n] [--path-skew us] [--read-buffer-mb n] [--hugepages] [service {service_args} | play {play_args}}" << std::endl << std::endl;
             std::cout << desc << std::endl;
             std::cout << "   {service_args} [-p]" << std::endl;
             std::cout << "   [-p, --port]]\t      http listening port" << std::endl << std::endl;
@@ -87,6 +137,8 @@ public:
             std::cout << "ipcaster play file1.ts 127.0.0.1 50000" << std::endl;
             std::cout << "ipcaster play file1.ts 127.0.0.1 50000 file2.ts 127.0.0.1 50001" << std::endl;
             std::cout << "ipcaster -v 5 service" << std::endl;
+            std::cout << "ipcaster --shards 4 --cpus 2,3,4,5 service" << std::endl;
+            std::cout << "ipcaster --backend packet-mmap --interface eth0 play file1.ts 239.0.0.1 50000" << std::endl;
             exit(0);
         }
 
@@ -95,6 +147,75 @@ public:
             exit(0);
         }
 
+        // Must be setup before any stream is created
+        if (vm.count("shards") || vm.count("cpus") || vm.count("burst-period") || vm.count("backend") || vm.count("txtime") || vm.count("gso") || 
+            vm.count("pacing") || vm.count("peak-rate") || vm.count("stream-peak-rate") || vm.count("connect") || vm.count("zerocopy") || vm.count("max-drift-ppm") ||
+            vm.count("late-policy") || vm.count("late-threshold") || vm.count("catchup-overspeed") || vm.count("pcr-restamp") || vm.count("fec") || vm.count("path-skew")) {
+            uint32_t shards = vm.count("shards") ? vm["shards"].as<uint32_t>() : 1;
+            std::vector<int> cpus;
+            if(vm.count("cpus"))
+                cpus = parseCPUs(vm["cpus"].as<std::string>());
+
+            uint32_t burst_period = vm.count("burst-period") ? vm["burst-period"].as<uint32_t>() : 4000;
+            if(!burst_period)
+                throw Exception("ConsoleOptions::parse() - burst-period must be greater than 0");
+
+            SenderOptions options;
+            if(vm.count("backend")) {
+                auto backend = vm["backend"].as<std::string>();
+                if(backend == "packet-mmap")
+                    options.backend = SenderOptions::Backend::PACKET_MMAP;
+                else if(backend == "io-uring")
+                    options.backend = SenderOptions::Backend::IO_URING;
+                else if(backend == "af-xdp")
+                    options.backend = SenderOptions::Backend::XDP_SOCKET;
+                else if(backend != "socket")
+                    throw Exception("ConsoleOptions::parse() - unknown backend " + backend);
+            }
+            if(vm.count("interface"))
+                options.interface = vm["interface"].as<std::string>();
+            if(vm.count("xdp-queue"))
+                options.xdp_queue = vm["xdp-queue"].as<uint32_t>();
+            options.txtime = vm.count("txtime") > 0;
+            options.gso = vm.count("gso") > 0;
+            options.pacing = vm.count("pacing") > 0;
+            if(vm.count("peak-rate"))
+                options.peak_rate = static_cast<uint64_t>(vm["peak-rate"].as<double>() * 1000000);
+            if(vm.count("stream-peak-rate"))
+                options.stream_peak_rate = static_cast<uint64_t>(vm["stream-peak-rate"].as<double>() * 1000000);
+            options.connect = vm.count("connect") > 0;
+            options.zerocopy = vm.count("zerocopy") > 0;
+            if(vm.count("max-drift-ppm"))
+                options.max_drift_ppm = vm["max-drift-ppm"].as<uint32_t>();
+            if(vm.count("late-policy")) {
+                auto policy = vm["late-policy"].as<std::string>();
+                if(policy == "drop")
+                    options.late_policy = SenderOptions::LatePolicy::DROP;
+                else if(policy == "resync")
+                    options.late_policy = SenderOptions::LatePolicy::RESYNC;
+                else if(policy != "catch-up")
+                    throw Exception("ConsoleOptions::parse() - unknown late policy " + policy);
+            }
+            if(vm.count("late-threshold"))
+                options.late_threshold = std::chrono::milliseconds(vm["late-threshold"].as<uint32_t>());
+            if(vm.count("catchup-overspeed")) {
+                options.catchup_overspeed = vm["catchup-overspeed"].as<double>();
+                // Below 1 the late datagrams would be sent slower than the stream
+                if(options.catchup_overspeed != 0 && !(options.catchup_overspeed >= 1))
+                    throw Exception("ConsoleOptions::parse() - catchup-overspeed must be 0 (unbounded) or at least 1");
+            }
+            options.pcr_restamp = vm.count("pcr-restamp") > 0;
+            if(vm.count("fec")) {
+                auto fec = vm["fec"].as<std::string>();
+                if(sscanf(fec.c_str(), "%ux%u", &options.fec_columns, &options.fec_rows) != 2)
+                    throw Exception("ConsoleOptions::parse() - invalid FEC matrix " + fec + ", expected LxD");
+            }
+            if(vm.count("path-skew"))
+                options.path_skew = std::chrono::microseconds(vm["path-skew"].as<uint32_t>());
+
+            ip_caster_.setSenderShards(shards, cpus, std::chrono::microseconds(burst_period), options);
+        }
+
         if(vm["command"].as<std::string>() == "service") {
             boost::program_options::options_description service_desc("service options");
             service_desc.add_options()
@@ -120,6 +241,34 @@ public:
             std::vector<std::string> opts = boost::program_options::collect_unrecognized(parsed.options, boost::program_options::include_positional);
             opts.erase(opts.begin());
             auto streams = parsePlay(opts);
+
+            if(vm.count("timestamps")) {
+                auto timestamps = vm["timestamps"].as<std::string>();
+                if(timestamps != "bitrate" && timestamps != "pcr")
+                    throw Exception("ConsoleOptions::parse() - unknown timestamps mode " + timestamps);
+
+                for(auto& stream : streams)
+                    stream[U("timestamps")] = web::json::value(UTF16(timestamps));
+            }
+
+            if(vm.count("path2")) {
+                auto port_offset = vm.count("path2-port-offset") ? vm["path2-port-offset"].as<uint16_t>() : 0;
+
+                for(auto& stream : streams) {
+                    web::json::value endpoint;
+                    endpoint[U("ip")] = web::json::value(UTF16(checkIP(vm["path2"].as<std::string>())));
+                    endpoint[U("port")] = web::json::value(stream[U("endpoint")][U("port")].as_integer() + port_offset);
+                    stream[U("endpoint2")] = endpoint;
+                }
+            }
+
+            for(auto& stream : streams) {
+                if(vm.count("read-buffer-mb"))
+                    stream[U("read_buffer_mb")] = web::json::value(vm["read-buffer-mb"].as<uint32_t>());
+                if(vm.count("hugepages"))
+                    stream[U("hugepages")] = web::json::value(true);
+            }
+
             setupStreams(streams);
         }
 
@@ -157,6 +306,22 @@ private:
      */
     uint16_t checkPort(const std::string& port) { return static_cast<uint16_t>(atoi(port.c_str())); }
 
+    /**
+     * Parses a comma separated list of CPU indexes
+     * @returns The CPUs list
+     */
+    std::vector<int> parseCPUs(const std::string& cpus_list)
+    {
+        std::vector<int> cpus;
+        std::stringstream ss(cpus_list);
+        std::string cpu;
+
+        while(std::getline(ss, cpu, ','))
+            cpus.push_back(atoi(cpu.c_str()));
+
+        return cpus;
+    }
+
     /**
      * Parses the parameters, translate them to json and applies the configuration to the IPCaster object
      * 
@@ -35,10 +35,30 @@ web::json::value IPCaster::createStream(web::json::value json_stream )
 {
     std::lock_guard<std::mutex> lock(streams_mutex_);
 
+    // Optional "endpoint2" SMPTE 2022-7 secondary path, the media datagrams are sent to both endpoints
+    std::string secondary_ip;
+    uint16_t secondary_port = 0;
+    if(json_stream.has_field(U("endpoint2"))) {
+        secondary_ip = UTF8(json_stream[U("endpoint2")][U("ip")].as_string());
+        secondary_port = static_cast<uint16_t>(json_stream[U("endpoint2")][U("port")].as_integer());
+    }
+
     auto udp_stream = datagrams_muxer_.createStream(UTF8(json_stream[U("endpoint")][U("ip")].as_string()),
-        static_cast<uint16_t>(json_stream[U("endpoint")][U("port")].as_integer()));
+        static_cast<uint16_t>(json_stream[U("endpoint")][U("port")].as_integer()), secondary_ip, secondary_port);
+
+    // Optional "timestamps": "pcr" for VBR files, the packets are timed by their PCRs instead of the file bitrate
+    auto timestamp_mode = MPEG2TSFileParser::TimestampMode::BITRATE;
+    if(json_stream.has_field(U("timestamps")) && UTF8(json_stream[U("timestamps")].as_string()) == "pcr")
+        timestamp_mode = MPEG2TSFileParser::TimestampMode::PCR;
 
-    auto source = SourceFactory<MPEG2TSFileToUDP>::create(UTF8(json_stream[U("source")].as_string()), *udp_stream);
+    // Optional "read_buffer_mb" memory ceiling of the file read buffers and "hugepages" to back them with huge pages
+    MPEG2TSBufferPool::Options pool_options;
+    if(json_stream.has_field(U("read_buffer_mb")))
+        pool_options.max_bytes = static_cast<size_t>(json_stream[U("read_buffer_mb")].as_integer()) * 1024 * 1024;
+    if(json_stream.has_field(U("hugepages")))
+        pool_options.hugepages = json_stream[U("hugepages")].as_bool();
+
+    auto source = SourceFactory<MPEG2TSFileToUDP>::create(UTF8(json_stream[U("source")].as_string()), *udp_stream, timestamp_mode, pool_options);
     auto stream = std::make_shared<Stream>(json_stream, source);
 
     // Observe the stream to handle eof or error events
@@ -53,6 +73,8 @@ web::json::value IPCaster::createStream(web::json::value json_stream )
         << stream->getSourceName() << " -> " << stream->getTargetName() 
         << std::endl;
 
+    traceMuxerStatus();
+
     return stream->json();
 }
 
@@ -72,6 +94,8 @@ void IPCaster::deleteStream(uint32_t stream_id, bool flush)
     streams_.erase(stream);
 
     Logger::get().info() << "Stream deleted: stream_id = " << stream_id <<  std::endl;
+
+    traceMuxerStatus();
 }
 
 web::json::value IPCaster::listStreams()
@@ -97,6 +121,11 @@ void IPCaster::setServiceMode(bool enable_server_mode, uint16_t listening_port)
     main_loop_timeout_ = std::chrono::milliseconds(service_mode_ ? 1000 : 100);
 }
 
+void IPCaster::setSenderShards(size_t num_shards, const std::vector<int>& cpus, std::chrono::microseconds burst_period, const SenderOptions& options)
+{
+    datagrams_muxer_.configure(num_shards, cpus, ShardedDatagramsMuxer<Timer>::Policy::LEAST_BITRATE, burst_period, options);
+}
+
 int IPCaster::run()
 {
     if(service_mode_) {
@@ -159,4 +188,33 @@ void IPCaster::printStatus()
         fflush(stdout);
         }
     }
+}
+
+void IPCaster::traceMuxerStatus()
+{
+    auto streams = datagrams_muxer_.getStreams();
+
+    Logger::get().debug() << "DatagramsMuxer " << datagrams_muxer_.numShards() << " shards " 
+        << streams.size() << " streams " << datagrams_muxer_.stats() << std::endl;
+
+    for(auto& stream : streams) {
+        Logger::get().debug() << "Stream " << stream->endpoint() << " drift " << stream->drift().count() / 1000000.0 << "(ms) offset " 
+            << stream->scheduleOffset().count() / 1000000.0 << "(ms)" << (stream->driftSaturated() ? " saturated" : "") << std::endl;
+
+        auto lateness = stream->latenessStats();
+        std::stringstream histogram;
+        for(auto count : lateness.histogram)
+            histogram << " " << count;
+
+        Logger::get().debug() << "Stream " << stream->endpoint() << " late prepared " << lateness.late_prepared << " dropped " << lateness.dropped 
+            << " resyncs " << lateness.resyncs << " max lateness " << lateness.max_lateness.count() / 1000000.0 << "(ms) histogram" << histogram.str() << std::endl;
+
+        if(stream->dualPath()) {
+            for(auto path : {DatagramsMuxer<Timer>::Stream::PRIMARY_PATH, DatagramsMuxer<Timer>::Stream::SECONDARY_PATH}) {
+                auto path_stats = stream->pathStats(path);
+                Logger::get().debug() << "Stream " << stream->endpoint() << " path " << (path == DatagramsMuxer<Timer>::Stream::PRIMARY_PATH ? stream->endpoint() : stream->secondaryEndpoint()) 
+                    << " datagrams " << path_stats.datagrams << " bytes " << path_stats.bytes << " max lateness " << path_stats.max_lateness.count() / 1000000.0 << "(ms)" << std::endl;
+            }
+        }
+    }
 }
\ No newline at end of file
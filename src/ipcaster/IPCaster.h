@@ -21,7 +21,7 @@
 
 #include <cpprest/json.h>
 
-#include "ipcaster/net/DatagramsMuxer.hpp"
+#include "ipcaster/net/ShardedDatagramsMuxer.hpp"
 #include "ipcaster/media/Timer.hpp"
 
 #include "FuturesCollector.hpp"
@@ -94,6 +94,26 @@ public:
      */
     void setServiceMode(bool enable_server_mode, uint16_t listening_port = 8080); 
 
+    /**
+     * Sets the number of sender shards (prepare / sender threads pairs)
+     * the streams are spread among
+     * 
+     * @param num_shards Number of shards
+     * 
+     * @param cpus CPUs to pin the shards to (shard i to cpus[i % cpus.size()]),
+     * if empty the shards are not pinned
+     * 
+     * @param burst_period Period between bursts of the sender threads
+     * 
+     * @param options Egress setup of the sender threads
+     * 
+     * @pre This function must be called before any stream is created
+     * 
+     * @throws std::exception Thrown on failure.
+     */
+    void setSenderShards(size_t num_shards, const std::vector<int>& cpus, std::chrono::microseconds burst_period = std::chrono::milliseconds(4), 
+        const SenderOptions& options = SenderOptions());
+
     /**
      * IPCaster application main loop. Does maintenance tasks until exit command is received (server mode)
      * or threre's no streams to process (command line mode)
@@ -120,8 +140,9 @@ public:
     // Service listening port
     uint16_t service_port_;
 
-    // One datagrams muxer per ethernet interface is required to orchestrate packet order and timing for all the SMPTE2022 streams sent to that interface
-    DatagramsMuxer<Timer> datagrams_muxer_;
+    // Orchestrates packet order and timing for all the SMPTE2022 streams, the streams
+    // are spread among one or more DatagramsMuxer shards (one per core)
+    ShardedDatagramsMuxer<Timer> datagrams_muxer_;
 
     // Main loop maintenance tasks review period
     std::chrono::milliseconds main_loop_timeout_;
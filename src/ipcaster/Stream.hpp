@@ -101,7 +101,13 @@ public:
      */
     std::string getTargetName() 
     { 
-        return utility::conversions::to_utf8string(stream_json_[U("endpoint")][U("ip")].as_string()) + ":" + std::to_string(stream_json_[U("endpoint")][U("port")].as_integer());
+        auto name = utility::conversions::to_utf8string(stream_json_[U("endpoint")][U("ip")].as_string()) + ":" + std::to_string(stream_json_[U("endpoint")][U("port")].as_integer());
+
+        // SMPTE 2022-7 secondary path
+        if(stream_json_.has_field(U("endpoint2")))
+            name += " + " + utility::conversions::to_utf8string(stream_json_[U("endpoint2")][U("ip")].as_string()) + ":" + std::to_string(stream_json_[U("endpoint2")][U("port")].as_integer());
+
+        return name;
     }
 
 private:
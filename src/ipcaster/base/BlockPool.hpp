@@ -0,0 +1,173 @@
+//
+// Copyright (C) 2019 Adofo Martinez <adolfo at ipcaster dot net>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#pragma once
+
+#include <mutex>
+#include <memory>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+namespace ipcaster
+{
+
+/**
+ * Thread safe pool of fixed size memory blocks.
+ *
+ * The blocks are carved from slabs allocated on demand and recycled when
+ * deallocated, the slabs are only released when the pool is destroyed. So once
+ * the pool has grown to the max number of blocks in use, allocating and
+ * deallocating doesn't reach the system allocator.
+ */
+class BlockPool
+{
+public:
+
+    /** Constructor
+     *
+     * @param block_size Size of the blocks, rounded up to the max fundamental alignment
+     *
+     * @param blocks_per_slab Number of blocks allocated at once when the pool grows
+     */
+    BlockPool(size_t block_size, size_t blocks_per_slab = 256)
+        :   block_size_((block_size + alignof(std::max_align_t) - 1) / alignof(std::max_align_t) * alignof(std::max_align_t)),
+            blocks_per_slab_(blocks_per_slab)
+    {
+    }
+
+    BlockPool(const BlockPool&) = delete;
+    BlockPool& operator=(const BlockPool&) = delete;
+
+    /** @returns A free block, the pool grows a slab if there's none */
+    void* allocate()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        if(free_blocks_.empty())
+            grow();
+
+        auto block = free_blocks_.back();
+        free_blocks_.pop_back();
+
+        return block;
+    }
+
+    /** Returns a block to the pool */
+    void deallocate(void* block)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        free_blocks_.push_back(block);
+    }
+
+    /** @returns The size of the blocks */
+    inline size_t blockSize() const { return block_size_; }
+
+    /** @returns The number of blocks owned by the pool (in use or free) */
+    size_t capacity()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        return slabs_.size() * blocks_per_slab_;
+    }
+
+private:
+
+    // Size of every block
+    size_t block_size_;
+
+    // Blocks allocated when the pool grows
+    size_t blocks_per_slab_;
+
+    std::mutex mutex_;
+
+    // Memory of the blocks
+    std::vector<std::unique_ptr<std::max_align_t[]>> slabs_;
+
+    // Blocks not in use
+    std::vector<void*> free_blocks_;
+
+    /** Allocates a new slab and adds its blocks to the free ones */
+    void grow()
+    {
+        slabs_.emplace_back(new std::max_align_t[block_size_ * blocks_per_slab_ / sizeof(std::max_align_t)]);
+
+        auto slab = reinterpret_cast<uint8_t*>(slabs_.back().get());
+
+        // Reserved upfront so deallocate() never reallocates
+        free_blocks_.reserve(slabs_.size() * blocks_per_slab_);
+
+        for(size_t i = blocks_per_slab_; i > 0; i--)
+            free_blocks_.push_back(slab + (i - 1) * block_size_);
+    }
+};
+
+/**
+ * Standard allocator drawing single objects from a BlockPool, intended for
+ * std::allocate_shared so the object and its control block are recycled.
+ * The allocations that don't fit in a block fall back to std::allocator.
+ *
+ * The allocator keeps the pool alive, so the pooled objects can outlive their creator.
+ */
+template<class T>
+class PoolAllocator
+{
+public:
+
+    using value_type = T;
+
+    /** Constructor
+     * @param pool Pool the objects are allocated from
+     */
+    PoolAllocator(std::shared_ptr<BlockPool> pool) : pool_(std::move(pool)) {}
+
+    template<class U>
+    PoolAllocator(const PoolAllocator<U>& other) : pool_(other.pool()) {}
+
+    T* allocate(size_t n)
+    {
+        if(fits(n))
+            return static_cast<T*>(pool_->allocate());
+
+        return std::allocator<T>().allocate(n);
+    }
+
+    void deallocate(T* p, size_t n)
+    {
+        if(fits(n))
+            pool_->deallocate(p);
+        else
+            std::allocator<T>().deallocate(p, n);
+    }
+
+    /** @returns The pool of the allocator */
+    inline const std::shared_ptr<BlockPool>& pool() const { return pool_; }
+
+    template<class U>
+    bool operator==(const PoolAllocator<U>& other) const { return pool_ == other.pool(); }
+
+    template<class U>
+    bool operator!=(const PoolAllocator<U>& other) const { return pool_ != other.pool(); }
+
+private:
+
+    std::shared_ptr<BlockPool> pool_;
+
+    inline bool fits(size_t n) const { return n == 1 && sizeof(T) <= pool_->blockSize() && alignof(T) <= alignof(std::max_align_t); }
+};
+
+}
@@ -66,6 +66,26 @@ public:
             throw std::bad_alloc();
     }
 
+    /** Constructor
+     * 
+     * Wraps memory owned by someone else (e.g. a buffer pool), the memory is not
+     * released by the buffer
+     * 
+     * @param data Pointer to the memory
+     * 
+     * @param capacity Size of the memory
+     * 
+     * @param size Size of the payload (current valid data in the buffer)
+     */
+    BufferBase(void* data, size_t capacity, size_t size) :
+        data_(data),
+        size_(size),
+        capacity_(capacity),
+        allocator_(nullptr),
+        owns_data_(false)
+    {
+    }
+
     /** Constructor
      * 
      * Creates a sub-buffer pointing to a fragment of a parent buffer already allocated
@@ -81,8 +101,8 @@ public:
      */
     BufferBase(void* data, size_t capacity, size_t size, std::shared_ptr<BufferBase<Allocator>> parent) :
         data_(data),
-        capacity_(capacity),
         size_(size),
+        capacity_(capacity),
         parent_(parent),
         allocator_(parent->allocator_)
     {
@@ -93,7 +113,7 @@ public:
      */
     virtual ~BufferBase()
     {
-        if(!parent_) {
+        if(!parent_ && owns_data_) {
             if(allocator_) {
                 allocator_->deallocate(static_cast<uint8_t*>(data_), capacity_);
             }
@@ -121,6 +141,9 @@ public:
         return a;
     }
 
+    /** @returns The parent buffer, nullptr if this is not a sub-buffer */
+    inline const std::shared_ptr<BufferBase<Allocator>>& parent() const { return parent_; }
+
     /** @returns A 32-bit id associated to de payload type */
     inline uint32_t payloadId() const {return payload_id_;}
 
@@ -155,6 +178,9 @@ private:
 
     // Pointer to the allocator used to create the buffer
     std::shared_ptr<Allocator> allocator_;
+
+    // False if the memory is owned by someone else (only meaningful if not parent)
+    bool owns_data_ = true;
 };
 
 // Buffer with std::allocator 
@@ -0,0 +1,137 @@
+//
+// Copyright (C) 2019 Adofo Martinez <adolfo at ipcaster dot net>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#else
+#include <mutex>
+#include <condition_variable>
+#endif
+
+namespace ipcaster {
+
+/**
+ * Event count, lets a thread park until a condition changes without the
+ * notifier taking a lock
+ *
+ * The waiter announces itself with prepareWait(), checks its condition again
+ * and then either cancelWait() or wait(). The notifier changes the condition
+ * and calls notify(), which only reaches the kernel (futex on Linux) when
+ * the waiter is announced, and withdraws the announce so the next notify()
+ * calls don't reach the kernel again before the waiter runs.
+ *
+ * @pre Only one thread waits, any number of threads can notify
+ */
+class EventCount
+{
+public:
+
+    EventCount()
+        :   epoch_(0),
+            waiting_(false)
+    {
+    }
+
+    EventCount(const EventCount&) = delete;
+    EventCount& operator=(const EventCount&) = delete;
+
+    /**
+     * Announces the calling thread is about to wait
+     *
+     * @returns The key to pass to wait()
+     */
+    uint32_t prepareWait()
+    {
+        waiting_.store(true, std::memory_order_seq_cst);
+        // Pairs with the fence of notify(): either the waiter sees the new
+        // condition or the notifier sees the waiter
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+
+        return epoch_.load(std::memory_order_acquire);
+    }
+
+    /** Withdraws the announce of prepareWait(), the condition was already met */
+    void cancelWait()
+    {
+        waiting_.store(false, std::memory_order_relaxed);
+    }
+
+    /**
+     * Parks the calling thread until notify() is called after prepareWait()
+     *
+     * @param key Returned by prepareWait()
+     */
+    void wait(uint32_t key)
+    {
+#ifdef __linux__
+        while(epoch_.load(std::memory_order_acquire) == key)
+            syscall(SYS_futex, reinterpret_cast<uint32_t*>(&epoch_), FUTEX_WAIT_PRIVATE, key, nullptr, nullptr, 0);
+#else
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+
+            while(epoch_.load(std::memory_order_acquire) == key)
+                condition_.wait(lock);
+        }
+#endif
+    }
+
+    /**
+     * Wakes the waiting thread, if any
+     *
+     * @pre The condition of the waiter was changed before the call
+     */
+    void notify()
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+
+        // The load keeps the cache line shared while nobody waits
+        if(!waiting_.load(std::memory_order_relaxed) || !waiting_.exchange(false, std::memory_order_acq_rel))
+            return;
+
+        epoch_.fetch_add(1, std::memory_order_release);
+
+#ifdef __linux__
+        syscall(SYS_futex, reinterpret_cast<uint32_t*>(&epoch_), FUTEX_WAKE_PRIVATE, 1, nullptr, nullptr, 0);
+#else
+        std::lock_guard<std::mutex> lock(mutex_);
+        condition_.notify_one();
+#endif
+    }
+
+private:
+
+    // Incremented by every notify() reaching the waiter, the futex word
+    std::atomic<uint32_t> epoch_;
+
+    // Set by prepareWait(), cleared by the first notify() or cancelWait()
+    std::atomic<bool> waiting_;
+
+#ifndef __linux__
+    std::mutex mutex_;
+
+    std::condition_variable condition_;
+#endif
+};
+
+}
@@ -16,10 +16,11 @@
 
 #pragma once
 
-#include <condition_variable>
-#include <mutex>
+#include <atomic>
+#include <memory>
+#include <cstddef>
 
-#include <boost/lockfree/spsc_queue.hpp>
+#include "ipcaster/base/EventCount.hpp"
 
 namespace ipcaster {
 
@@ -29,21 +30,28 @@ namespace ipcaster {
  * Allows the produder thread to wait when FIFO is full.
  * Allows the consumer thread to wait when FIFO is empty.
  * 
- * @todo Implement lock-free push / pop when the FIFO is neither full not empty
+ * Push and pop are wait-free when the FIFO is neither full nor empty: the
+ * indices live in their own cache lines and a thread only parks (and is only
+ * woken through the kernel) when it actually has to wait.
  */
 template <typename T>
 class FIFO
 {
 public:
     FIFO(size_t capacity) 
-        :   queue_(capacity), 
-            capacity_(capacity), 
-            producer_is_waiting_(false), 
-            consumer_is_waiting_(false),
+        :   head_(0),
+            tail_(0),
+            head_cache_(0),
             unblock_producer_(false),
-            unblock_consumer_(false)
+            unblock_consumer_(false),
+            capacity_(capacity)
     {
+        size_t slots = 1;
+        while(slots < capacity_)
+            slots <<= 1;
 
+        mask_ = slots - 1;
+        slots_ = std::unique_ptr<T[]>(new T[slots]);
     }
 
     /** 
@@ -52,24 +60,25 @@ public:
      * @pre Only one thread (producer) is allowed to push data to the FIFO
      * @returns false is the FIFO is full, true otherwise.
      *
-     * @note Thread-safe
+     * @note Thread-safe and wait-free
      */
     bool tryPush(const T& element)
     {
-        // If the queue is not full
-        if(queue_.push(element)) {
+        auto tail = tail_.load(std::memory_order_relaxed);
 
-            std::lock_guard<std::mutex> lock_empty(mutex_empty_);
+        // The consumer index is only read when the cached one says the queue is full
+        if(tail - head_cache_ == capacity_) {
+            head_cache_ = head_.load(std::memory_order_acquire);
+            if(tail - head_cache_ == capacity_)
+                return false;
+        }
 
-            if(consumer_is_waiting_) {
-                consumer_is_waiting_ = false;
-                condition_empty_.notify_one(); // awake the consumer
-            }
+        slots_[tail & mask_] = element;
+        tail_.store(tail + 1, std::memory_order_release);
 
-            return true;
-        }
+        not_empty_.notify(); // awake the consumer if it's waiting
 
-        return false;
+        return true;
     }
 
     /** 
@@ -80,29 +89,21 @@ public:
      * @pre Only one thread(producer) is allowed to push data to the FIFO
      * @param [in] element Reference to the element to be pushed.
      *
-     * @note Thread-safe
+     * @note Thread-safe, wait-free if the FIFO is not full
      * The calling thread can be unblocked invoking unblockConsumer() from
      * another thread.
      */
     void push(const T& element)
     {
-        // If the queue is full
-        if(!queue_.push(element)) {
+        while(!tryPush(element) && !unblock_producer_.load(std::memory_order_acquire)) {
 
-            std::unique_lock<std::mutex> lock_full(mutex_full_);
+            auto key = not_full_.prepareWait();
 
-            while(!queue_.push(element) && !unblock_producer_) {
-                producer_is_waiting_ = true;
-                // Wait until pop is done by the consumer
-                condition_full_.wait(lock_full);
-            }
-        }
-
-        std::lock_guard<std::mutex> lock_empty(mutex_empty_);
-
-        if(consumer_is_waiting_) {
-            consumer_is_waiting_ = false;
-            condition_empty_.notify_one(); // awake the consumer
+            // Wait until pop is done by the consumer
+            if(writeAvailable() || unblock_producer_.load(std::memory_order_acquire))
+                not_full_.cancelWait();
+            else
+                not_full_.wait(key);
         }
     }
 
@@ -119,7 +120,7 @@ public:
      */
     T& front()
     {
-        return queue_.front();
+        return slots_[head_.load(std::memory_order_relaxed) & mask_];
     }
 
     /** 
@@ -127,18 +128,17 @@ public:
      *
      * @pre only one thread(consumer) is allowed to pop data from the FIFO
      *
-     * @note Thread-safe
+     * @note Thread-safe and wait-free
      */
     void pop()
     {
-        queue_.pop();
+        auto head = head_.load(std::memory_order_relaxed);
 
-        std::lock_guard<std::mutex> lock_full(mutex_full_);
+        // Release the resources holded by the element before handing the slot back
+        slots_[head & mask_] = T();
+        head_.store(head + 1, std::memory_order_release);
 
-        if(producer_is_waiting_) {
-            producer_is_waiting_ = false;
-            condition_full_.notify_one(); // awake the producer
-        }
+        not_full_.notify(); // awake the producer if it's waiting
     }
 
     /** 
@@ -150,7 +150,7 @@ public:
      */
     size_t writeAvailable() const
     {
-        return queue_.write_available();
+        return capacity_ - (tail_.load(std::memory_order_relaxed) - head_.load(std::memory_order_acquire));
     }
 
     /** 
@@ -162,7 +162,7 @@ public:
      */
     size_t readAvailable() const
     {
-        return queue_.read_available();
+        return tail_.load(std::memory_order_acquire) - head_.load(std::memory_order_relaxed);
     }
 
     /** 
@@ -176,17 +176,17 @@ public:
      */
     size_t waitReadAvailable()
     {
-        size_t pop_available = queue_.read_available();
-        // If the queue is empty
-        if(!pop_available) { 
+        size_t pop_available;
+
+        while(!(pop_available = readAvailable()) && !unblock_consumer_.load(std::memory_order_acquire)) {
 
-            std::unique_lock<std::mutex> lock_empty(mutex_empty_);
+            auto key = not_empty_.prepareWait();
 
-            while(!(pop_available = queue_.read_available()) && !unblock_consumer_) {
-                consumer_is_waiting_ = true;
-                // Wait until push is done by the producer
-                condition_empty_.wait(lock_empty);
-            }
+            // Wait until push is done by the producer
+            if(readAvailable() || unblock_consumer_.load(std::memory_order_acquire))
+                not_empty_.cancelWait();
+            else
+                not_empty_.wait(key);
         }
 
         return pop_available;
@@ -218,9 +218,8 @@ public:
      */
     void unblockProducer(bool unblock = true) 
     {
-        std::lock_guard<std::mutex> lock_full(mutex_full_);
-        unblock_producer_ = unblock;
-        condition_full_.notify_one(); // awake the producer
+        unblock_producer_.store(unblock, std::memory_order_release);
+        not_full_.notify(); // awake the producer
     }
 
     /** 
@@ -237,9 +236,8 @@ public:
      */
     void unblockConsumer(bool unblock = true) 
     {
-        std::unique_lock<std::mutex> lock_empty(mutex_empty_);
-        unblock_consumer_ = unblock;
-        condition_empty_.notify_one(); // awake the consumer
+        unblock_consumer_.store(unblock, std::memory_order_release);
+        not_empty_.notify(); // awake the consumer
     }
 
     /** 
@@ -253,40 +251,42 @@ public:
     {
         unblock_consumer_ = false;
         unblock_producer_ = false;
-        queue_.reset();
+
+        while(readAvailable())
+            pop();
     }
 
 private:
 
-    // If true avoid the producer wait
-    bool unblock_producer_;
+    // Read index (written by the consumer), in its own cache line
+    alignas(64) std::atomic<size_t> head_;
 
-    // If true avoid the consumer wait
-    bool unblock_consumer_;
+    // Write index (written by the producer), in its own cache line
+    alignas(64) std::atomic<size_t> tail_;
 
-    // Flag
-    bool producer_is_waiting_;
+    // Last read index seen by the producer, refreshed only when the FIFO looks full
+    size_t head_cache_;
 
-    // Flag
-    bool consumer_is_waiting_;
+    // Parks the consumer while the FIFO is empty
+    alignas(64) EventCount not_empty_;
 
-    // Lockfree queue
-    boost::lockfree::spsc_queue<T> queue_;
+    // Parks the producer while the FIFO is full
+    alignas(64) EventCount not_full_;
 
-    // Mutex for condition full
-    std::mutex mutex_full_;
+    // If true avoid the producer wait
+    alignas(64) std::atomic<bool> unblock_producer_;
 
-    // To wait (consumer) if the queue is full
-    std::condition_variable condition_full_;
+    // If true avoid the consumer wait
+    std::atomic<bool> unblock_consumer_;
 
-    // Mutex for condition empty
-    std::mutex mutex_empty_;
+    // Max number of elements
+    size_t capacity_;
 
-    // To wait (producer) if queue if empty 
-    std::condition_variable condition_empty_;
+    // Number of slots (power of 2) - 1
+    size_t mask_;
 
-    // Number of allocated elements
-    size_t capacity_;
+    // Elements storage
+    std::unique_ptr<T[]> slots_;
 };
 
 }
\ No newline at end of file
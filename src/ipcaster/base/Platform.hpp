@@ -77,4 +77,37 @@
 
 #include <byteswap.h>
 
-#endif
\ No newline at end of file
+#endif
+
+#include <thread>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace ipcaster
+{
+
+/**
+ * Pins a thread to a CPU
+ * 
+ * @param thread The thread to pin
+ * 
+ * @param cpu Index of the CPU
+ * 
+ * @returns false if the platform doesn't support it or the call failed
+ */
+inline bool setThreadAffinity(std::thread& thread, int cpu)
+{
+#ifdef __linux__
+    cpu_set_t cpuset;
+    CPU_ZERO(&cpuset);
+    CPU_SET(cpu, &cpuset);
+    return pthread_setaffinity_np(thread.native_handle(), sizeof(cpu_set_t), &cpuset) == 0;
+#else
+    return false;
+#endif
+}
+
+}
\ No newline at end of file
@@ -0,0 +1,148 @@
+//
+// Copyright (C) 2019 Adofo Martinez <adolfo at ipcaster dot net>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <cstddef>
+
+namespace ipcaster {
+
+/**
+ * Bounded lock-free single producer / single consumer ring
+ *
+ * Unlike FIFO, the consumer can peek any of the available elements
+ * and consume them in place (no copy), and no thread ever waits.
+ * The capacity is rounded up to a power of 2.
+ */
+template <typename T>
+class SPSCRing
+{
+public:
+
+    /** Constructor
+     *
+     * @param capacity Minimum number of elements the ring can hold
+     */
+    SPSCRing(size_t capacity)
+        :   head_(0),
+            tail_(0)
+    {
+        capacity_ = 1;
+        while(capacity_ < capacity)
+            capacity_ <<= 1;
+
+        mask_ = capacity_ - 1;
+        slots_ = std::unique_ptr<T[]>(new T[capacity_]);
+    }
+
+    /**
+     * Push one element into the ring
+     *
+     * @pre Only one thread (producer) is allowed to push
+     * @returns false if the ring is full, true otherwise.
+     */
+    bool push(const T& element)
+    {
+        auto tail = tail_.load(std::memory_order_relaxed);
+
+        if(tail - head_.load(std::memory_order_acquire) == capacity_)
+            return false;
+
+        slots_[tail & mask_] = element;
+        tail_.store(tail + 1, std::memory_order_release);
+
+        return true;
+    }
+
+    /**
+     * @returns The number of elements that can be pushed
+     *
+     * @note Should only be called from the producer thread
+     */
+    size_t writeAvailable() const
+    {
+        return capacity_ - (tail_.load(std::memory_order_relaxed) - head_.load(std::memory_order_acquire));
+    }
+
+    /**
+     * @returns The number of elements that can be peeked / consumed
+     *
+     * @note Should only be called from the consumer thread
+     */
+    size_t readAvailable() const
+    {
+        return tail_.load(std::memory_order_acquire) - head_.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * Get a reference to an available element
+     *
+     * @param index Position from the front of the ring
+     *
+     * @pre Only the consumer thread is allowed to peek
+     * @pre index < readAvailable()
+     */
+    inline T& peek(size_t index)
+    {
+        return slots_[(head_.load(std::memory_order_relaxed) + index) & mask_];
+    }
+
+    /**
+     * Releases the front elements of the ring
+     *
+     * @param count Number of elements to release
+     *
+     * @pre Only the consumer thread is allowed to consume
+     * @pre count <= readAvailable()
+     */
+    void consume(size_t count)
+    {
+        auto head = head_.load(std::memory_order_relaxed);
+
+        // Release the resources holded by the elements before handing the slots back
+        for(size_t i = 0; i < count; i++)
+            slots_[(head + i) & mask_] = T();
+
+        head_.store(head + count, std::memory_order_release);
+    }
+
+    /** @returns The max number of elements that can be stored in the ring */
+    size_t capacity() const
+    {
+        return capacity_;
+    }
+
+private:
+
+    // Read index (written by the consumer), in its own cache line
+    alignas(64) std::atomic<size_t> head_;
+
+    // Write index (written by the producer), in its own cache line
+    alignas(64) std::atomic<size_t> tail_;
+
+    // Number of slots (power of 2)
+    alignas(64) size_t capacity_;
+
+    // capacity_ - 1
+    size_t mask_;
+
+    // Elements storage
+    std::unique_ptr<T[]> slots_;
+};
+
+}
@@ -19,7 +19,7 @@
 #ifdef _MSC_VER // Windows
 #include "TimerSleep.hpp"
 #else // Linux / Unix
-#include "TimerLibEvent.hpp"
+#include "TimerHybrid.hpp"
 #endif
 
 namespace ipcaster
@@ -28,7 +28,7 @@ namespace ipcaster
 #ifdef _MSC_VER // Windows
 	using Timer = TimerSleep;
 #else // Linux / Unix
-	using Timer = TimerLibEvent;
+	using Timer = TimerHybrid;
 #endif
 
 }
\ No newline at end of file
@@ -0,0 +1,148 @@
+//
+// Copyright (C) 2019 Adofo Martinez <adolfo at ipcaster dot net>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#pragma once
+
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <cassert>
+#include <csignal>
+#include <cstdlib>
+
+#ifdef __linux__
+#include <time.h>
+#include <errno.h>
+#endif
+
+namespace ipcaster
+{
+
+/**
+ * Implements a high precision waitable Timer with a fix period
+ *
+ * The calling thread sleeps until an absolute deadline (clock_nanosleep with
+ * TIMER_ABSTIME on Linux) and optionally busy-spins the last microseconds to
+ * absorb the wake-up latency of the OS scheduler.
+ * The deadlines are a fixed grid (start + n * period) so the timer doesn't
+ * drift, and there's no extra thread or context switch per period, what
+ * makes sub-millisecond periods practical.
+ *
+ * As TimerLibEvent did, the timer handles SIGINT (Ctrl-C) quitting the 
+ * program with exit(SIGINT) from the waiting thread, so the static objects 
+ * are destroyed.
+ */
+class TimerHybrid
+{
+    using SteadyClock = std::chrono::steady_clock;
+
+public:
+
+    /** Constructor
+     *
+     * @param period Period of the timer in nanoseconds, greater than 0
+     *
+     * @param spin Time before every deadline that is busy-waited instead of slept,
+     * 0 to disable the spinning
+     */
+    TimerHybrid(const std::chrono::nanoseconds& period, const std::chrono::nanoseconds& spin = std::chrono::microseconds(50))
+    : period_(period), spin_(spin)
+    {
+        assert(period_.count() > 0);
+
+        // Installed once for all the timers
+        static const bool sigint_handler_installed = (std::signal(SIGINT, &TimerHybrid::onSigint), true);
+        (void)sigint_handler_installed;
+
+        next_deadline_ = SteadyClock::now() + period_;
+    }
+
+    /**
+    * Waits until the next period deadline
+    * If the deadline already expired no wait is done. If one or more whole periods
+    * were missed, the next deadline is realigned to the periods grid.
+    *
+    * @returns The current std::high_resolution_clock time.
+    *
+    * @note Concurrency is not supported so there should only be one thread
+    * calling wait at a time.
+    */
+    std::chrono::high_resolution_clock::time_point wait()
+    {
+        sleepUntil(next_deadline_ - spin_);
+
+        // Spin the last part
+        while(SteadyClock::now() < next_deadline_);
+
+        // Ctrl-C, quit from a regular thread context (only the first timer to see it)
+        if(sigint_received_.load(std::memory_order_relaxed) && sigint_received_.exchange(false))
+            exit(SIGINT);
+
+        next_deadline_ += period_;
+
+        // Skip the missed periods
+        auto now = SteadyClock::now();
+        if(next_deadline_ < now)
+            next_deadline_ += ((now - next_deadline_) / period_ + 1) * period_;
+
+        return std::chrono::high_resolution_clock::now();
+    }
+
+    /** @returns The period of the timer */
+    inline std::chrono::nanoseconds period() { return period_; }
+
+	/** @returns The current std::high_resolution_clock time. */
+	inline std::chrono::high_resolution_clock::time_point now()
+	{
+		return std::chrono::high_resolution_clock::now();
+	}
+
+private:
+
+    std::chrono::nanoseconds period_;
+
+    std::chrono::nanoseconds spin_;
+
+    // Next absolute deadline
+    SteadyClock::time_point next_deadline_;
+
+    // Set by the SIGINT handler, handled by the next wait() of any timer
+    static inline std::atomic<bool> sigint_received_{false};
+
+    /** SIGINT handler, only flags the signal (exit() isn't async-signal-safe) */
+    static void onSigint(int)
+    {
+        sigint_received_.store(true, std::memory_order_relaxed);
+    }
+
+    /** Sleeps until an absolute SteadyClock time point */
+    void sleepUntil(const SteadyClock::time_point& deadline)
+    {
+#ifdef __linux__
+        // libstdc++ steady_clock is CLOCK_MONOTONIC
+        auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(deadline.time_since_epoch()).count();
+        struct timespec ts;
+        ts.tv_sec = static_cast<time_t>(ns / 1000000000);
+        ts.tv_nsec = static_cast<long>(ns % 1000000000);
+
+        while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr) == EINTR);
+#else
+        std::this_thread::sleep_until(deadline);
+#endif
+    }
+};
+
+}
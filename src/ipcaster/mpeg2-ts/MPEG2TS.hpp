@@ -156,6 +156,9 @@ public:
     /** @returns true if packet contains a PCR */
     inline bool hasPCR() const { return afSize() > 0 && (pkt_[5] & 0x10) != 0; }
 
+    /** Sets the discontinuity_indicator of the adaptation field, the packet must have a non empty one */
+    inline void setDiscontinuityIndicator() { pkt_[5] |= 0x80; }
+
     /** @returns The PCR's value */
     uint64_t pcr() const
     {
@@ -167,6 +170,22 @@ public:
         return pcr_base * 300 + pcr_ext;
     }
 
+    /** 
+     * Sets the PCR's value, the packet must have a PCR
+     * @param pcr New 42bit PCR value
+     */
+    void setPCR(uint64_t pcr)
+    {
+        const uint64_t pcr_base = pcr / 300;
+        const uint16_t pcr_ext = static_cast<uint16_t>(pcr % 300);
+        pkt_[6] = static_cast<uint8_t>(pcr_base >> 25);
+        pkt_[7] = static_cast<uint8_t>(pcr_base >> 17);
+        pkt_[8] = static_cast<uint8_t>(pcr_base >> 9);
+        pkt_[9] = static_cast<uint8_t>(pcr_base >> 1);
+        pkt_[10] = static_cast<uint8_t>(((pcr_base & 1) << 7) | 0x7E | (pcr_ext >> 8));
+        pkt_[11] = static_cast<uint8_t>(pcr_ext);
+    }
+
 private:
 
     // @returns a 32bits word in the right endian order for current architecture
@@ -17,12 +17,119 @@
 #pragma once
 
 #include <stdint.h>
+#include <array>
+#include <vector>
+#include <algorithm>
 
 #include "ipcaster/base/Buffer.hpp"
 
 namespace ipcaster
 {
 
+/**
+ * Send timestamps (in PCR units) of the packets of a MPEG2TSBuffer.
+ * 
+ * Instead of a timestamp per packet, the timestamps are piecewise linear segments:
+ * every segment times its packets from a base timestamp at a constant rate, in 32.32
+ * fixed point ticks per packet. A CBR buffer is a single segment, a PCR interpolated 
+ * one has a segment per PCR found in it. The timestamps are computed on demand.
+ */
+class MPEG2TSTimestamps
+{
+public:
+
+    // Segments stored without allocating, more are stored in overflow_
+    static const size_t INLINE_SEGMENTS = 4;
+
+    /** Removes all the segments, the packets have no timestamps */
+    void clear()
+    {
+        num_segments_ = 0;
+        overflow_.clear();
+    }
+
+    /** 
+     * Appends a segment, it lasts until the first packet of the next one
+     * 
+     * @param first Index of the first packet of the segment, the segments must be appended
+     * in packet order
+     * 
+     * @param base Timestamp of the first packet
+     * 
+     * @param rate Ticks per packet in 32.32 fixed point, see toRate()
+     */
+    void append(size_t first, uint64_t base, uint64_t rate)
+    {
+        Segment segment = { first, base, rate };
+
+        if(num_segments_ < INLINE_SEGMENTS)
+            segments_[num_segments_++] = segment;
+        else
+            overflow_.push_back(segment);
+    }
+
+    /** @returns The timestamp of the packet at index, 0 if there are no segments */
+    inline uint64_t at(size_t index) const
+    {
+        auto segment = find(index);
+        if(!segment)
+            return 0;
+
+        uint64_t packets = index > segment->first ? index - segment->first : 0;
+
+        // Integer and fractional parts of the rate apart, so it doesn't overflow
+        return segment->base + packets * (segment->rate >> 32) + ((packets * (segment->rate & 0xFFFFFFFF)) >> 32);
+    }
+
+    /** @returns The rate (see append()) of the packet at index, 0 if there are no segments */
+    inline uint64_t rate(size_t index) const
+    {
+        auto segment = find(index);
+
+        return segment ? segment->rate : 0;
+    }
+
+    /** @returns ticks_per_packet in 32.32 fixed point */
+    static inline uint64_t toRate(double ticks_per_packet)
+    {
+        return static_cast<uint64_t>(ticks_per_packet * 4294967296.0 + 0.5);
+    }
+
+private:
+
+    struct Segment
+    {
+        size_t first;
+        uint64_t base;
+        uint64_t rate;
+    };
+
+    std::array<Segment, INLINE_SEGMENTS> segments_;
+    size_t num_segments_ = 0;
+
+    // Segments after the INLINE_SEGMENTS first ones
+    std::vector<Segment> overflow_;
+
+    /** @returns The segment of the packet at index, nullptr if there are no segments */
+    inline const Segment* find(size_t index) const
+    {
+        if(!num_segments_)
+            return nullptr;
+
+        // The segments are sorted by first, the one of the packet is the last starting at or 
+        // before it. A buffer can have tens of them (e.g. a segment per datagram of a carry buffer)
+        auto before = [](size_t index, const Segment& segment) { return index < segment.first; };
+
+        if(!overflow_.empty() && overflow_.front().first <= index)
+            return &*(std::upper_bound(overflow_.begin(), overflow_.end(), index, before) - 1);
+
+        auto segment = std::upper_bound(segments_.begin(), segments_.begin() + num_segments_, index, before);
+
+        // The packets before the first segment follow it
+        return segment == segments_.begin() ? &segments_[0] : &*(segment - 1);
+    }
+};
+
 /**
  * Handles TS memory buffers, extends ipcaster::Buffer
  * 
@@ -42,13 +149,34 @@ public:
      */
     MPEG2TSBuffer(size_t num_packets_capacity, uint8_t packet_size) 
         :   Buffer(num_packets_capacity*packet_size), 
-            packet_size_(packet_size),
-            num_packets_(0)
+            num_packets_(0),
+            packet_size_(packet_size)
     {
-	    allocated_timestamps_ = std::unique_ptr<uint64_t[]>(new uint64_t[num_packets_capacity]);
+	    allocated_timestamps_ = std::make_unique<MPEG2TSTimestamps>();
         timestamps_ = allocated_timestamps_.get();   
     }
 
+    /** Constructor
+     * 
+     * Wraps packets memory and timestamps owned by someone else (e.g. MPEG2TSBufferPool),
+     * they're not released by the buffer
+     * 
+     * @param data Pointer to the packets memory
+     * 
+     * @param timestamps Pointer to the timestamps
+     * 
+     * @param num_packets_capacity Number of packets that fit in the memory
+     * 
+     * @param packet_size TS packet's size
+     */
+    MPEG2TSBuffer(void* data, MPEG2TSTimestamps* timestamps, size_t num_packets_capacity, uint8_t packet_size)
+        :   Buffer(data, num_packets_capacity*packet_size, 0),
+            num_packets_(0),
+            packet_size_(packet_size)
+    {
+        timestamps_ = timestamps;
+    }
+
     /** Constructor
      * 
      * Creates a sub-buffer pointing to a fragment of a parent buffer already allocated
@@ -56,7 +184,9 @@ public:
      * 
      * @param data Pointer to the sub-buffer data (must belong to the parent buffer space)
      * 
-     * @param timestamps Pointer to the sub-buffer parent's timestamps 
+     * @param timestamps Pointer to the parent's timestamps 
+     * 
+     * @param timestamps_offset Index in the parent's timestamps of the first packet of the sub-buffer
      * 
      * @param num_packets_capacity "Allocated" number of packets of the sub-buffer
      * 
@@ -66,15 +196,16 @@ public:
      * 
      * @param parent Shared pointer to the parent
      */
-    MPEG2TSBuffer(void* data, uint64_t* timestamps, size_t num_packets_capacity, size_t num_packets_size, uint8_t packet_size, std::shared_ptr<MPEG2TSBuffer> parent)
+    MPEG2TSBuffer(void* data, MPEG2TSTimestamps* timestamps, size_t timestamps_offset, size_t num_packets_capacity, size_t num_packets_size, uint8_t packet_size, std::shared_ptr<MPEG2TSBuffer> parent)
         :   Buffer(data, num_packets_capacity*packet_size, num_packets_size*packet_size, parent),
-            packet_size_(packet_size),
-            num_packets_(num_packets_size)
+            num_packets_(num_packets_size),
+            packet_size_(packet_size)
 
     {
         // TODO: assert data belongs to parent
 
         timestamps_ = timestamps;
+        timestamps_offset_ = timestamps_offset;
     }
 
     /**
@@ -93,10 +224,24 @@ public:
      */
     std::shared_ptr<MPEG2TSBuffer> makeChild(size_t packet_index, size_t num_packets_capacity, size_t num_packets_size)
     {
-        auto a = std::make_shared<MPEG2TSBuffer>(packet(packet_index), &timestamps_[packet_index], num_packets_capacity, num_packets_size, packet_size_, std::static_pointer_cast<MPEG2TSBuffer>(this->shared_from_this()));
+        auto a = std::make_shared<MPEG2TSBuffer>(packet(packet_index), timestamps_, timestamps_offset_ + packet_index, num_packets_capacity, num_packets_size, packet_size_, std::static_pointer_cast<MPEG2TSBuffer>(this->shared_from_this()));
         return a;
     }
 
+    /**
+     * Creates a sub-buffer pointing to a fragment of this buffer, the sub-buffer
+     * object is allocated with a user allocator (e.g. PoolAllocator)
+     * 
+     * @see makeChild(size_t, size_t, size_t)
+     * 
+     * @param allocator Allocator used with std::allocate_shared
+     */
+    template<class Alloc>
+    std::shared_ptr<MPEG2TSBuffer> makeChild(size_t packet_index, size_t num_packets_capacity, size_t num_packets_size, const Alloc& allocator)
+    {
+        return std::allocate_shared<MPEG2TSBuffer>(allocator, packet(packet_index), timestamps_, timestamps_offset_ + packet_index, num_packets_capacity, num_packets_size, packet_size_, std::static_pointer_cast<MPEG2TSBuffer>(this->shared_from_this()));
+    }
+
     /**
      * Sets the size of valid data in the buffer
      * @param num_packets Number of valid ts packets in the buffer
@@ -126,10 +271,20 @@ public:
      * 
      * @returns The timestamp (in PCR units) of the packet at a specific index
      */
-    inline uint64_t timestamp(size_t index) const { return timestamps_[index]; }
+    inline uint64_t timestamp(size_t index) const { return timestamps_->at(timestamps_offset_ + index); }
 
-    /** @returns A pointer to the packet's timestamps array */
-    inline uint64_t* timestamps() const { return timestamps_; }
+    /** 
+     * @param index Index of the packet in the buffer
+     * 
+     * @returns The rate of the timestamps at a specific index, see MPEG2TSTimestamps
+     */
+    inline uint64_t timestampRate(size_t index) const { return timestamps_->rate(timestamps_offset_ + index); }
+
+    /** 
+     * @returns The packets timestamps, shared with the parent for sub-buffers (indexed 
+     * from the first packet of the parent)
+     */
+    inline MPEG2TSTimestamps& timestamps() const { return *timestamps_; }
 
 private:
 
@@ -139,11 +294,14 @@ private:
     // TS packet size (188 / 204)
     uint8_t packet_size_;
 
-    // Allocated space for timestamps (only allocated if this is the parent buffer)
-    std::unique_ptr<uint64_t[]> allocated_timestamps_;
+    // Allocated timestamps (only allocated if this is the parent buffer)
+    std::unique_ptr<MPEG2TSTimestamps> allocated_timestamps_;
     
-    // PCR Timestamps array, every element is paired with a ts packet in the buffer
-    uint64_t* timestamps_;
+    // PCR Timestamps of the packets, the ones of the parent for sub-buffers
+    MPEG2TSTimestamps* timestamps_;
+
+    // Index in timestamps_ of the first packet of the buffer
+    size_t timestamps_offset_ = 0;
 };
 
 }
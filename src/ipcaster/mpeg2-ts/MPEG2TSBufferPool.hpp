@@ -0,0 +1,321 @@
+//
+// Copyright (C) 2019 Adofo Martinez <adolfo at ipcaster dot net>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#pragma once
+
+#include <mutex>
+#include <memory>
+#include <vector>
+#include <string>
+#include <cstring>
+#include <cerrno>
+#include <condition_variable>
+
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/mman.h>
+#include <fstream>
+#endif
+
+#include "ipcaster/base/Exception.hpp"
+#include "ipcaster/base/Logger.hpp"
+#include "ipcaster/base/BlockPool.hpp"
+#include "ipcaster/mpeg2-ts/MPEG2TSBuffer.hpp"
+
+namespace ipcaster
+{
+
+/**
+ * Bounded pool of MPEG2TSBuffers for the file reads.
+ *
+ * The packets of the buffers live in slots of a single page aligned arena, optionally
+ * backed by huge pages, and their timestamps in a model kept by the pool per slot. A
+ * buffer returns its slot to the pool when its last reference (e.g. the last datagram
+ * pointing to it) is released, so once the slots in use have been touched the reads
+ * don't page fault nor reach the allocator.
+ *
+ * The arena is the hard memory ceiling of the pool: acquire() blocks while all the
+ * slots are in use.
+ */
+class MPEG2TSBufferPool : public std::enable_shared_from_this<MPEG2TSBufferPool>
+{
+public:
+
+    /** Setup of the pool */
+    struct Options
+    {
+        // Ceiling of the memory of the packets of the pool in bytes, 0 = sized by the user of the pool
+        size_t max_bytes = 0;
+
+        // Back the arena with huge pages (MAP_HUGETLB), falls back to regular pages
+        // (with transparent huge pages advice) if the system has none available
+        bool hugepages = false;
+    };
+
+    /** Constructor
+     *
+     * Reserves the arena, its pages are touched the first time their slot is used
+     *
+     * @param num_packets_capacity Number of packets of every buffer
+     *
+     * @param packet_size TS packet's size
+     *
+     * @param max_buffers Number of buffers of the pool
+     *
+     * @param hugepages Back the arena with huge pages, see Options
+     *
+     * @throws std::exception If the arena can't be allocated
+     */
+    MPEG2TSBufferPool(size_t num_packets_capacity, uint8_t packet_size, size_t max_buffers, bool hugepages = false)
+        :   num_packets_capacity_(num_packets_capacity),
+            packet_size_(packet_size),
+            max_buffers_(max_buffers),
+            object_pool_(std::make_shared<BlockPool>(OBJECT_BLOCK_SIZE, 16))
+    {
+        if(!max_buffers_ || !num_packets_capacity_)
+            throw Exception(fndbg(MPEG2TSBufferPool) + "empty pool");
+
+        slot_size_ = bufferMemory(num_packets_capacity_, packet_size_);
+
+        allocateArena(hugepages);
+
+        timestamps_.resize(max_buffers_);
+
+        free_slots_.reserve(max_buffers_);
+        for(size_t i = max_buffers_; i > 0; i--)
+            free_slots_.push_back(i - 1);
+
+        Logger::get().debug() << logfn(MPEG2TSBufferPool) << max_buffers_ << " buffers of " << slot_size_
+            << " bytes, huge pages " << (huge_pages_ ? "yes" : "no") << std::endl;
+    }
+
+    ~MPEG2TSBufferPool()
+    {
+        releaseArena();
+    }
+
+    MPEG2TSBufferPool(const MPEG2TSBufferPool&) = delete;
+    MPEG2TSBufferPool& operator=(const MPEG2TSBufferPool&) = delete;
+
+    /**
+     * Gets a free buffer, blocks until one is released if all are in use
+     *
+     * The buffer (and its children) keeps the pool alive.
+     *
+     * @returns The buffer, with no packets, nullptr if unblock() was called
+     */
+    std::shared_ptr<MPEG2TSBuffer> acquire()
+    {
+        size_t slot;
+
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+
+            while(free_slots_.empty() && !unblocked_)
+                slot_released_.wait(lock);
+
+            if(free_slots_.empty())
+                return nullptr;
+
+            slot = free_slots_.back();
+            free_slots_.pop_back();
+        }
+
+        // The slot is only used by this thread until the buffer is released
+        timestamps_[slot].clear();
+
+        return std::allocate_shared<PooledBuffer>(PoolAllocator<PooledBuffer>(object_pool_),
+            arena_ + slot * slot_size_, &timestamps_[slot], num_packets_capacity_, packet_size_,
+            shared_from_this(), slot);
+    }
+
+    /** Unblocks the threads waiting in acquire() and the next calls, they return nullptr */
+    void unblock()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        unblocked_ = true;
+        slot_released_.notify_all();
+    }
+
+    /** @returns The number of buffers of the pool */
+    inline size_t maxBuffers() const { return max_buffers_; }
+
+    /** @returns The memory used by the packets of every buffer in bytes */
+    inline size_t bufferMemory() const { return slot_size_; }
+
+    /** @returns The memory used by the packets of every buffer of a pool of buffers of num_packets_capacity packets */
+    static size_t bufferMemory(size_t num_packets_capacity, uint8_t packet_size)
+    {
+        return roundUp(num_packets_capacity * packet_size, pageSize());
+    }
+
+    /** @returns true if the arena is backed by huge pages */
+    inline bool hugePages() const { return huge_pages_; }
+
+    /** @returns The number of buffers in use */
+    size_t buffersInUse()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        return max_buffers_ - free_slots_.size();
+    }
+
+private:
+
+    /** Buffer returning its slot to the pool on destruction */
+    class PooledBuffer : public MPEG2TSBuffer
+    {
+    public:
+
+        PooledBuffer(uint8_t* data, MPEG2TSTimestamps* timestamps, size_t num_packets_capacity, uint8_t packet_size,
+            std::shared_ptr<MPEG2TSBufferPool> pool, size_t slot)
+            :   MPEG2TSBuffer(data, timestamps, num_packets_capacity, packet_size),
+                pool_(std::move(pool)),
+                slot_(slot)
+        {
+        }
+
+        ~PooledBuffer()
+        {
+            pool_->release(slot_);
+        }
+
+    private:
+
+        std::shared_ptr<MPEG2TSBufferPool> pool_;
+
+        size_t slot_;
+    };
+
+    // Size of the blocks of object_pool_, fits a PooledBuffer with its shared_ptr control block
+    static constexpr size_t OBJECT_BLOCK_SIZE = 256;
+
+    size_t num_packets_capacity_;
+
+    uint8_t packet_size_;
+
+    size_t max_buffers_;
+
+    // Size of a slot (the packets of a buffer), page multiple
+    size_t slot_size_;
+
+    // Memory of the slots
+    uint8_t* arena_ = nullptr;
+    size_t arena_size_ = 0;
+    bool huge_pages_ = false;
+
+    // Timestamps of the buffer of every slot
+    std::vector<MPEG2TSTimestamps> timestamps_;
+
+    // Recycles the PooledBuffer objects
+    std::shared_ptr<BlockPool> object_pool_;
+
+    std::mutex mutex_;
+
+    // Signaled when a slot is released
+    std::condition_variable slot_released_;
+
+    // Slots not in use, the last released is the first reused (its pages are hot)
+    std::vector<size_t> free_slots_;
+
+    bool unblocked_ = false;
+
+    /** Returns a slot to the free ones */
+    void release(size_t slot)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        free_slots_.push_back(slot);
+        slot_released_.notify_one();
+    }
+
+    static size_t roundUp(size_t value, size_t multiple) { return (value + multiple - 1) / multiple * multiple; }
+
+    static size_t pageSize()
+    {
+#ifdef __linux__
+        return static_cast<size_t>(sysconf(_SC_PAGESIZE));
+#else
+        return 4096;
+#endif
+    }
+
+#ifdef __linux__
+    /** @returns The default huge page size of the system, 0 if unknown */
+    static size_t hugePageSize()
+    {
+        std::ifstream meminfo("/proc/meminfo");
+        std::string key;
+        size_t kb;
+
+        while(meminfo >> key) {
+            if(key == "Hugepagesize:" && meminfo >> kb)
+                return kb * 1024;
+        }
+
+        return 0;
+    }
+#endif
+
+    void allocateArena(bool hugepages)
+    {
+        arena_size_ = slot_size_ * max_buffers_;
+
+#ifdef __linux__
+        if(hugepages) {
+#ifdef MAP_HUGETLB
+            auto huge_page_size = hugePageSize();
+            if(huge_page_size) {
+                auto size = roundUp(arena_size_, huge_page_size);
+                auto arena = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+                if(arena != MAP_FAILED) {
+                    arena_ = static_cast<uint8_t*>(arena);
+                    arena_size_ = size;
+                    huge_pages_ = true;
+                    return;
+                }
+            }
+#endif
+            Logger::get().warning() << logclass(MPEG2TSBufferPool) << "no huge pages available (see /proc/sys/vm/nr_hugepages), using regular pages" << std::endl;
+        }
+
+        auto arena = mmap(nullptr, arena_size_, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if(arena == MAP_FAILED)
+            throw Exception(fndbg(MPEG2TSBufferPool) + "can't allocate " + std::to_string(arena_size_) + " bytes: " + strerror(errno));
+
+        arena_ = static_cast<uint8_t*>(arena);
+
+#ifdef MADV_HUGEPAGE
+        if(hugepages)
+            madvise(arena_, arena_size_, MADV_HUGEPAGE);
+#endif
+#else
+        arena_ = static_cast<uint8_t*>(::operator new(arena_size_, std::align_val_t(pageSize())));
+#endif
+    }
+
+    void releaseArena()
+    {
+#ifdef __linux__
+        munmap(arena_, arena_size_);
+#else
+        ::operator delete(arena_, std::align_val_t(pageSize()));
+#endif
+    }
+};
+
+}
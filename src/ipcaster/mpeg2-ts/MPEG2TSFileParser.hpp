@@ -17,6 +17,9 @@
 #pragma once
 
 #include <string>
+#include <deque>
+#include <chrono>
+#include <cmath>
 #include <cstdio>
 #include <cerrno>
 #include <ios>
@@ -25,6 +28,7 @@
 #include "ipcaster/base/Logger.hpp"
 #include "ipcaster/mpeg2-ts/MPEG2TSBuffer.hpp"
 #include "ipcaster/mpeg2-ts/MPEG2TSFilters.hpp"
+#include "ipcaster/mpeg2-ts/MPEG2TSBufferPool.hpp"
 
 namespace ipcaster
 {
@@ -41,16 +45,48 @@ public:
     // Size of the buffered read, will be rounded to ts-packet size multiple
     static const size_t APROX_READ_SIZE = (128*1024);
 
+    // Default size of the read buffers pool, in seconds of stream plus a few spare buffers.
+    // It holds the FIFO of the FileSource (1 second), the PCR mode read ahead (up to 1 second)
+    // and the buffers still referenced by the datagrams waiting to be sent
+    static const size_t POOL_SECONDS = 3;
+    static constexpr size_t MIN_POOL_BUFFERS = 8;
+
+    // Buffers held besides the preroll of the consumer: the one being read, the one
+    // processed by the FileSource consumer thread and the last block referenced by
+    // the muxer stream
+    static const size_t IN_FLIGHT_BUFFERS = 3;
+
+    /** How the send timestamps of the packets are computed */
+    enum class TimestampMode
+    {
+        BITRATE,    // From the packet position at the file bitrate (CBR files)
+        PCR         // Interpolated between the PCRs of the reference PID (VBR files)
+    };
+
     /** Constructor
      * 
      * Opens the file, finds a valid mpeg2-ts sync and computes the bitrate
      * 
      * @param file File path
      * 
-     * @notes Only CBR TS files including PCRs are supported, see ITU-T H.222.0
-     * standard
+     * @param mode Timestamping mode
+     * 
+     * @param pool_options Setup of the pool the read buffers are drawn from, with no 
+     * max_bytes the pool holds POOL_SECONDS of stream
+     * 
+     * @param consumer_preroll Stream time the consumer buffers before it releases any 
+     * buffer (e.g. the muxer send preroll), the pool must hold it
+     * 
+     * @throws std::exception If the file can't be parsed or pool_options.max_bytes doesn't 
+     * hold the consumer preroll
+     * 
+     * @notes The TS files must include PCRs, see ITU-T H.222.0 standard.
+     * The BITRATE mode only supports CBR files
      */
-    MPEG2TSFileParser(const std::string& file)
+    MPEG2TSFileParser(const std::string& file, TimestampMode mode = TimestampMode::BITRATE,
+        const MPEG2TSBufferPool::Options& pool_options = MPEG2TSBufferPool::Options(),
+        std::chrono::milliseconds consumer_preroll = std::chrono::milliseconds(0))
+        : mode_(mode)
     {
         Logger::get().debug() << logfn(MPEG2TSFileParser) << "file: " << file << std::endl;
 
@@ -64,6 +100,8 @@ public:
 
         // Computes the file bitrate based on PCRs
         computeBitrate();
+
+        createPool(pool_options, consumer_preroll);
     }
 
     /** Destructor
@@ -139,6 +177,10 @@ public:
     // Defines the PCRs distance threshold to compute bitrate
     static const uint64_t BITRATE_COMPUTE_PCR_DISTANCE = static_cast<uint64_t>(PCRCLOCKFREQUENCY * 3);
 
+    // PCR mode, larger distances between consecutive PCRs are discontinuities (the 
+    // standard max is 100ms), the segment is timed at the file bitrate
+    static const uint64_t MAX_PCR_INTERVAL = static_cast<uint64_t>(PCRCLOCKFREQUENCY);
+
     /** 
      * Calculates the file's bitrate based on PCR distance vs bytes.
      * The file must be TS CBR
@@ -152,19 +194,22 @@ public:
         uint64_t pcr_distance = 0;
         size_t bytes_distance;
 
-        std::shared_ptr<MPEG2TSBuffer> buffer = read();
+        std::shared_ptr<MPEG2TSBuffer> buffer = readPackets();
         
         // Push packets to the filter until enough PCR distance is accumulated or EOF
         while(buffer && pcr_distance < BITRATE_COMPUTE_PCR_DISTANCE) {
             pcr_filter.push(buffer, (size_t)ftell(file_));
             pcr_filter.getPIDWithGreaterPCRDistance(pid, pcr_distance, bytes_distance);
-            buffer = read();
+            buffer = readPackets();
         }
 
         if(pcr_distance == 0)
             throw Exception(fndbg(MPEG2TSFileParser) + "Unable to compute file bitrate, not enough PCRs found");
 
         bitrate_ = (uint64_t)(bytes_distance * 8 / (pcr_distance / PCRCLOCKFREQUENCY));
+
+        // The PCR mode follows the PCRs of the same PID
+        pcr_pid_ = pid;
         
         estimated_buffers_per_second_ = std::max(static_cast<uint32_t>(1), static_cast<uint32_t>(bitrate_ / (per_buffer_packets_ * packet_size_* 8.0)));
 
@@ -192,26 +237,37 @@ public:
 
     /** 
      * Reads the next payload buffer from the file
-     * @returns A shared pointer to the buffer
+     * 
+     * In PCR mode the buffers are read ahead until the next PCR after the buffer is
+     * found, so all its packets can be interpolated
+     * 
+     * @returns A shared pointer to the buffer, nullptr on EOF
      */
     std::shared_ptr<MPEG2TSBuffer> read()
     {
-        auto buffer = getBuffer();
+        if(mode_ == TimestampMode::PCR)
+            return readPCRTimestamped();
 
-        auto bytes = fread(buffer->data(), 1, buffer->capacity(), file_);
-        auto num_ts_packets = bytes / packet_size_;
+        auto buffer = readPackets();
 
-        if(num_ts_packets) {
-            buffer->setNumPackets(num_ts_packets); 
-            setTimestampsFromBitrate(buffer->timestamps(), packets_read_, bitrate_, num_ts_packets);
+        if(buffer) {
+            setTimestampsFromBitrate(buffer->timestamps(), packets_read_, bitrate_);
             packets_read_ += buffer->numPackets();
-
-            return buffer;
         }
 
-        return nullptr;
+        return buffer;
     }
 
+    /** Unblocks a read() waiting for a free buffer and the next ones, they return nullptr */
+    void unblock()
+    {
+        if(pool_)
+            pool_->unblock();
+    }
+
+    /** @returns The pool of the read buffers */
+    const std::shared_ptr<MPEG2TSBufferPool>& pool() const { return pool_; }
+
 private:
 
     // File handler
@@ -235,22 +291,231 @@ private:
     // Calculated file bitrate
     uint64_t bitrate_;
 
-    // Allocs a new buffer
+    // Timestamping mode
+    TimestampMode mode_;
+
+    // PCR mode, PID whose PCRs time the packets
+    uint16_t pcr_pid_ = 0;
+
+    // Read buffers, the reads of the bitrate computation are not pooled
+    std::shared_ptr<MPEG2TSBufferPool> pool_;
+
+    // PCR mode, max number of buffers read ahead looking for the next PCR, past it the 
+    // pending packets follow the rate of the last PCR segment (so the pool can't be exhausted)
+    size_t max_pending_buffers_ = 0;
+
+    // PCR mode, buffers read and not fully timestamped yet, with the index of their first packet
+    std::deque<std::pair<std::shared_ptr<MPEG2TSBuffer>, uint64_t>> pending_;
+
+    // PCR mode, number of packets already timestamped
+    uint64_t timestamped_packets_ = 0;
+
+    // PCR mode, timestamp of the last packet timestamped (timestamped_packets_ - 1)
+    uint64_t last_timestamp_ = 0;
+
+    // PCR mode, last PCR found: value, packet index and (unwrapped) timestamp
+    bool pcr_found_ = false;
+    uint64_t last_pcr_ = 0;
+    uint64_t last_pcr_index_ = 0;
+    uint64_t last_pcr_timestamp_ = 0;
+
+    // PCR mode, ticks per packet of the last PCR segment, used after the last PCR
+    double segment_ticks_per_packet_ = 0;
+
+    /** @returns The ticks per packet at the file bitrate */
+    double cbrTicksPerPacket() const { return packet_size_ * 8 * PCRCLOCKFREQUENCY / static_cast<double>(bitrate_); }
+
+    /** 
+     * Reads the next buffer of packets from the file, without timestamps
+     * @returns A shared pointer to the buffer, nullptr on EOF
+     */
+    std::shared_ptr<MPEG2TSBuffer> readPackets()
+    {
+        auto buffer = getBuffer();
+        if(!buffer)
+            return nullptr;
+
+        auto bytes = fread(buffer->data(), 1, buffer->capacity(), file_);
+        auto num_ts_packets = bytes / packet_size_;
+
+        if(num_ts_packets) {
+            buffer->setNumPackets(num_ts_packets); 
+            return buffer;
+        }
+
+        return nullptr;
+    }
+
+    /** PCR mode read(), see read() */
+    std::shared_ptr<MPEG2TSBuffer> readPCRTimestamped()
+    {
+        while(pending_.empty() || timestamped_packets_ < pending_.front().second + pending_.front().first->numPackets()) {
+            if(pending_.size() >= max_pending_buffers_) {
+                timestampUntil(packets_read_, 0, true);
+                break;
+            }
+
+            auto buffer = readPackets();
+
+            if(!buffer) {
+                // No more PCRs, the rest of the packets follow the last segment rate
+                timestampUntil(packets_read_, 0, true);
+                break;
+            }
+
+            pending_.push_back({buffer, packets_read_});
+
+            TSPacket packet(static_cast<uint8_t*>(buffer->data()), static_cast<uint8_t>(packet_size_));
+            for(size_t i = 0; i < buffer->numPackets(); i++, packet.moveNext()) {
+                if(packet.hasPCR() && packet.pid() == pcr_pid_)
+                    onPCR(packets_read_ + i, packet.pcr());
+            }
+
+            packets_read_ += buffer->numPackets();
+        }
+
+        if(pending_.empty())
+            return nullptr;
+
+        auto buffer = pending_.front().first;
+        pending_.pop_front();
+
+        return buffer;
+    }
+
+    /** 
+     * PCR mode, timestamps the packets from the previous PCR to a new one
+     * 
+     * @param index Index of the packet with the PCR
+     * 
+     * @param pcr PCR value
+     */
+    void onPCR(uint64_t index, uint64_t pcr)
+    {
+        auto cbr_ticks_per_packet = cbrTicksPerPacket();
+        uint64_t timestamp;
+
+        if(!pcr_found_) {
+            // The packets before the first PCR are timed at the file bitrate, so the first one is at 0
+            timestamp = static_cast<uint64_t>(index * cbr_ticks_per_packet);
+        }
+        else {
+            auto distance = pcrSub(last_pcr_, pcr);
+
+            // Discontinuity, the segment is timed at the file bitrate
+            if(distance == 0 || distance > MAX_PCR_INTERVAL)
+                distance = static_cast<uint64_t>((index - last_pcr_index_) * cbr_ticks_per_packet);
+
+            timestamp = last_pcr_timestamp_ + distance;
+        }
+
+        timestampUntil(index + 1, timestamp, false);
+
+        if(pcr_found_ && index > last_pcr_index_)
+            segment_ticks_per_packet_ = static_cast<double>(timestamp - last_pcr_timestamp_) / (index - last_pcr_index_);
+        else
+            segment_ticks_per_packet_ = cbr_ticks_per_packet;
+
+        pcr_found_ = true;
+        last_pcr_ = pcr;
+        last_pcr_index_ = index;
+        last_pcr_timestamp_ = timestamp;
+    }
+
+    /** 
+     * PCR mode, sets the timestamps of the pending packets until end (excluded)
+     * 
+     * @param end Index of the first packet not timestamped
+     * 
+     * @param end_timestamp Timestamp of the packet end - 1, the packets are interpolated
+     * between the last packet timestamped and it
+     * 
+     * @param extrapolate If true, end_timestamp is ignored and the packets follow the 
+     * rate of the last PCR segment
+     */
+    void timestampUntil(uint64_t end, uint64_t end_timestamp, bool extrapolate)
+    {
+        // Origin of the interpolation, the last packet timestamped: the previous PCR, or the 
+        // last packet extrapolated if the read ahead limit was reached, so the timestamps 
+        // don't jump at the boundary. The first packet (at 0) if none.
+        double origin_index = timestamped_packets_ ? static_cast<double>(timestamped_packets_ - 1) : 0.0;
+        double origin_timestamp = static_cast<double>(last_timestamp_);
+        double ticks_per_packet = pcr_found_ ? segment_ticks_per_packet_ : cbrTicksPerPacket();
+
+        // If the extrapolated packets went past the PCR, they wait for it (never backwards)
+        if(!extrapolate && end - 1 > origin_index)
+            ticks_per_packet = std::max(0.0, (end_timestamp - origin_timestamp) / (end - 1 - origin_index));
+
+        for(auto& entry : pending_) {
+            auto& buffer = entry.first;
+            auto first = entry.second;
+            auto last = first + buffer->numPackets();
+            auto begin = std::max(first, timestamped_packets_);
+
+            // A segment from the first packet of the buffer not timestamped yet
+            if(begin < std::min(last, end))
+                buffer->timestamps().append(begin - first, static_cast<uint64_t>(origin_timestamp + (begin - origin_index) * ticks_per_packet), 
+                    MPEG2TSTimestamps::toRate(ticks_per_packet));
+        }
+
+        if(end > timestamped_packets_) {
+            last_timestamp_ = static_cast<uint64_t>(origin_timestamp + (end - 1 - origin_index) * ticks_per_packet);
+            timestamped_packets_ = end;
+        }
+    }
+
+    // Gets a buffer from the pool (blocks while all are in use), nullptr if unblocked
     std::shared_ptr<MPEG2TSBuffer> getBuffer()
     {
-        return std::make_shared<MPEG2TSBuffer>(per_buffer_packets_, packet_size_);
+        if(!pool_)
+            return std::make_shared<MPEG2TSBuffer>(per_buffer_packets_, packet_size_);
+
+        return pool_->acquire();
     }
 
-    // Compute and sets the timestamps of the packets based on the calculated file bitrate
-    void setTimestampsFromBitrate(uint64_t* timestamps, uint64_t base_packet_index, uint64_t bitrate, size_t num_packets)
+    /** 
+     * Allocs the pool of the read buffers
+     * 
+     * The pool must hold the consumer preroll, otherwise the reads would block before 
+     * the consumer starts releasing buffers and the stream would never start
+     * 
+     * @throws std::exception If the memory ceiling doesn't hold the consumer preroll
+     */
+    void createPool(const MPEG2TSBufferPool::Options& options, std::chrono::milliseconds consumer_preroll)
     {
-        auto packets = num_packets;
-        auto ts = timestamps;
+        auto buffer_memory = MPEG2TSBufferPool::bufferMemory(per_buffer_packets_, static_cast<uint8_t>(packet_size_));
+
+        // The preroll can span one more buffer partially
+        auto preroll_buffers = static_cast<size_t>(std::ceil(consumer_preroll.count() / 1000.0 * bitrate_ / (per_buffer_packets_ * packet_size_ * 8.0))) + 1;
+        auto held_buffers = preroll_buffers + IN_FLIGHT_BUFFERS;
+
+        // The PCR mode needs at least a buffer of read ahead
+        auto min_buffers = std::max(MIN_POOL_BUFFERS, held_buffers + (mode_ == TimestampMode::PCR ? 1 : 0));
+        auto max_buffers = std::max(POOL_SECONDS * estimated_buffers_per_second_ + MIN_POOL_BUFFERS, min_buffers);
+
+        if(options.max_bytes) {
+            max_buffers = options.max_bytes / buffer_memory;
 
-        while(packets--) {
-            // packet timestamp in 27Mhz ticks for the base_packet_index position
-            (*ts++) = static_cast<uint64_t>(base_packet_index++ * packet_size_* 8 * PCRCLOCKFREQUENCY / (double)bitrate);
+            if(max_buffers < min_buffers)
+                throw Exception(fndbg(MPEG2TSFileParser) + "the buffers memory ceiling must be at least " + 
+                    std::to_string((min_buffers * buffer_memory + 1024 * 1024 - 1) / (1024 * 1024)) + " MB to hold the " + 
+                    std::to_string(consumer_preroll.count()) + " ms send preroll of the " + std::to_string(bitrate_) + " bps stream");
         }
+
+        pool_ = std::make_shared<MPEG2TSBufferPool>(per_buffer_packets_, static_cast<uint8_t>(packet_size_), max_buffers, options.hugepages);
+
+        // The read ahead leaves room for the buffers held by the consumer
+        max_pending_buffers_ = std::min(static_cast<size_t>(estimated_buffers_per_second_) + 1, max_buffers - held_buffers);
+    }
+
+    // Compute and sets the timestamps of the packets based on the calculated file bitrate, 
+    // a single segment from the timestamp of the first packet
+    void setTimestampsFromBitrate(MPEG2TSTimestamps& timestamps, uint64_t base_packet_index, uint64_t bitrate)
+    {
+        // packet timestamp in 27Mhz ticks for the base_packet_index position
+        auto base = static_cast<uint64_t>(base_packet_index * packet_size_* 8 * PCRCLOCKFREQUENCY / (double)bitrate);
+
+        timestamps.append(0, base, MPEG2TSTimestamps::toRate(packet_size_* 8 * PCRCLOCKFREQUENCY / (double)bitrate));
     }
 };
 
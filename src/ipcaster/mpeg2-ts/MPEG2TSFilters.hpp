@@ -17,6 +17,8 @@
 #pragma once
 
 #include <map>
+#include <vector>
+#include <chrono>
 #include <iostream>
 #include <fstream>
 
@@ -114,4 +116,90 @@ private:
 
 };
 
+/**
+ * Rewrites the PCRs of a TS stream with the actual departure time of their 
+ * packets, so the downstream equipment doesn't measure the send scheduling 
+ * granularity as PCR jitter.
+ * 
+ * Every PCR PID is anchored at its first PCR, then the restamped PCRs advance 
+ * with the departure time from the anchor. If the original PCRs deviate from
+ * the departure timeline more than a discontinuity (file loops, splices...),
+ * the PID is anchored again and the discontinuity_indicator of the PCR
+ * packet is set.
+ */
+class PCRRestamper
+{
+public:
+
+    // Deviation between the original PCRs and the departure timeline that is a discontinuity
+    static constexpr uint64_t DISCONTINUITY = static_cast<uint64_t>(PCRCLOCKFREQUENCY);
+
+    /**
+     * Restamps the PCRs in a group of TS packets that depart at the same time
+     * 
+     * @param data Pointer to the TS packets (188 or 204 bytes)
+     * 
+     * @param size Size of the packets data
+     * 
+     * @param departure Departure time of the packets (any epoch, constant for the stream)
+     */
+    void restamp(void* data, size_t size, std::chrono::nanoseconds departure)
+    {
+        uint8_t packet_size = size % 188 == 0 ? 188 : (size % 204 == 0 ? 204 : 0);
+        if(!packet_size)
+            return;
+
+        // In 27Mhz ticks, divided first so epoch based departures don't overflow
+        auto departure_ns = static_cast<uint64_t>(departure.count());
+        uint64_t departure_ticks = departure_ns / 1000 * 27 + departure_ns % 1000 * 27 / 1000;
+
+        TSPacket packet(static_cast<uint8_t*>(data), packet_size);
+
+        for(size_t offset = 0; offset < size; offset += packet_size, packet.moveNext()) {
+            if(static_cast<uint8_t*>(data)[offset] != MPEG2TSSYNCBYTE || !packet.hasPCR())
+                continue;
+
+            auto pcr = packet.pcr();
+            auto& anchor = pidAnchor(packet.pid(), pcr, departure_ticks);
+
+            auto restamped = (anchor.pcr + (departure_ticks - anchor.departure)) % (PCRMAXVALUE + 1);
+
+            // Discontinuity, anchor again at this PCR and signal the jump of the restamped timeline
+            if(std::min(pcrSub(pcr, restamped), pcrSub(restamped, pcr)) > DISCONTINUITY) {
+                anchor.pcr = pcr;
+                anchor.departure = departure_ticks;
+                restamped = pcr;
+                packet.setDiscontinuityIndicator();
+            }
+
+            packet.setPCR(restamped);
+        }
+    }
+
+private:
+
+    // Original PCR of a PID and its departure time (27Mhz ticks) the PID restamping starts from
+    struct Anchor
+    {
+        uint16_t pid;
+        uint64_t pcr;
+        uint64_t departure;
+    };
+
+    // Anchors of the PCR PIDs of the stream (usually one)
+    std::vector<Anchor> anchors_;
+
+    /** @returns The anchor of a PID, set at the current PCR if it's the first one */
+    Anchor& pidAnchor(uint16_t pid, uint64_t pcr, uint64_t departure)
+    {
+        for(auto& anchor : anchors_) {
+            if(anchor.pid == pid)
+                return anchor;
+        }
+
+        anchors_.push_back({pid, pcr, departure});
+        return anchors_.back();
+    }
+};
+
 }
@@ -0,0 +1,104 @@
+//
+// Copyright (C) 2019 Adofo Martinez <adolfo at ipcaster dot net>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#pragma once
+
+#include <chrono>
+#include <memory>
+#include <cstddef>
+#include <cstdint>
+
+#include "ipcaster/net/IP.hpp"
+
+namespace ipcaster
+{
+
+/**
+ * Interface of the egress backends used by the DatagramsMuxer.
+ *
+ * The datagrams of a burst are queued with push() and sent with flush(),
+ * the backend decides how (socket syscalls, kernel rings, ...).
+ */
+class BurstSender
+{
+public:
+
+    virtual ~BurstSender() {}
+
+    /**
+     * Prepares the backend to send to a destination, called when a stream is created
+     *
+     * @param address Destination IP
+     *
+     * @throws std::exception If the backend can't send to the destination
+     */
+    virtual void addDestination(const ip::address& /*address*/) {}
+
+    /**
+     * Queues a datagram to be sent in the next flush()
+     *
+     * @param endpoint Target ip and port
+     *
+     * @param data Pointer to the payload, must remain valid until flush() returns
+     *
+     * @param size Size of the payload in bytes
+     *
+     * @param txtime Transmission time (CLOCK_MONOTONIC nanoseconds), only used
+     * if txTimeEnabled()
+     *
+     * @param socket Socket connected to the endpoint to send through, -1 to use
+     * the backend one. Ignored by the raw backends.
+     */
+    virtual void push(const ip::udp::endpoint& endpoint, const void* data, size_t size, uint64_t txtime = 0, int socket = -1) = 0;
+
+    /**
+     * Sends all the queued datagrams
+     *
+     * @returns The number of system calls used to send the burst
+     *
+     * @throws std::exception Thrown on failure.
+     */
+    virtual size_t flush() = 0;
+
+    /** 
+     * Keeps alive the payload buffer of the last pushed datagram until the kernel
+     * no longer uses it. Only needed if zeroCopyEnabled()
+     */
+    virtual void pin(std::shared_ptr<const void> /*buffer*/) {}
+
+    /** @returns true if the kernel transmits from the pushed payloads after flush() returns, see pin() */
+    virtual bool zeroCopyEnabled() const { return false; }
+
+    /** @returns true if the datagrams are released by the kernel at their txtime */
+    virtual bool txTimeEnabled() const { return false; }
+
+    /** @returns Fraction (0 to 1) of the transmit ring used by the last flush, 0 if the backend has no ring */
+    virtual float ringOccupancy() const { return 0; }
+
+    /** @returns The number of datagrams that couldn't be sent */
+    virtual uint64_t sendFailures() const { return 0; }
+
+    /** @returns Asynchronous backends, time spent submitting the last burst (0 if synchronous) */
+    virtual std::chrono::nanoseconds submitLatency() const { return std::chrono::nanoseconds(0); }
+
+    /** 
+     * @returns Asynchronous backends, max time from submission to completion of the 
+     * datagrams completed in the last flush (0 if synchronous)
+     */
+    virtual std::chrono::nanoseconds completeLatency() const { return std::chrono::nanoseconds(0); }
+};
+
+}
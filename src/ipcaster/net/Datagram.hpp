@@ -28,46 +28,35 @@ namespace ipcaster
 /**
  * Represents a datagram to be send in a (timed-based) scheduling manner
  * This class holds a strong reference to the payload data buffer as long as
- * destination ip, port, send_tick
+ * send_tick and a reference to the (already resolved) destination endpoint
  */
 class Datagram
 {
 public:
 
     /** Constructor
-     * @param target_ip Destination IPv4 address
-     * @param target_port Destination port
      * @param payload shared pointer to payload buffer
      * @param send_tick Send timepoint 
      */
-    Datagram (const std::string& target_ip, 
-                uint16_t target_port, 
-                std::shared_ptr<Buffer> payload,
+    Datagram (std::shared_ptr<Buffer> payload,
                 std::chrono::high_resolution_clock::time_point send_tick)
-            :   target_ip_(target_ip), 
-                target_port_(target_port),
-                payload_(payload),
-                send_tick_(send_tick)
+            :   payload_(payload),
+                send_tick_(send_tick),
+                endpoint_(nullptr)
     {
     }
 
-    /** @returns The target ip */
-    inline const char* targetIP() {return target_ip_.c_str();}
-
-    /** Sets the target IP */    
-    inline void setTargetIP(const std::string& target_ip) { target_ip_ = target_ip; }
-
-    /** @returns The target port */    
-    inline uint16_t targetPort() {return target_port_;}
-
-    /** Sets the target port */    
-    inline void setTargetPort(uint16_t target_port) { target_port_ = target_port; }
-
     /** @returns The payload buffer reference */    
-    inline std::shared_ptr<Buffer> payload() {return payload_;}
+    inline const std::shared_ptr<Buffer>& payload() const {return payload_;}
+
+    /** 
+     * @returns The destination endpoint, nullptr if not set yet. The endpoint is
+     * owned by the stream the datagram has been pushed to
+     */    
+    inline const ip::udp::endpoint* endpoint() const { return endpoint_; }
 
-    /** @returns An endpoint object pointing to the target address:port */    
-    inline ip::udp::endpoint endpoint() {return ip::udp::endpoint(ip::address::from_string(target_ip_.c_str()),target_port_); }
+    /** Sets the destination endpoint (must outlive the datagram scheduling) */    
+    inline void setEndpoint(const ip::udp::endpoint* endpoint) { endpoint_ = endpoint; }
 
     /** @returns The send timepoint */    
     std::chrono::high_resolution_clock::time_point sendTick() { return send_tick_; }
@@ -79,8 +68,7 @@ private:
 
     std::shared_ptr<Buffer> payload_;
     std::chrono::high_resolution_clock::time_point send_tick_;
-    std::string target_ip_;
-    uint16_t target_port_;
+    const ip::udp::endpoint* endpoint_;
 };
 
 }
\ No newline at end of file
@@ -19,11 +19,25 @@
 #include <iostream>
 #include <mutex>
 #include <list>
+#include <deque>
+#include <map>
+#include <array>
+#include <algorithm>
 
 #include "ipcaster/base/FIFO.hpp"
+#include "ipcaster/base/SPSCRing.hpp"
+#include "ipcaster/base/EventCount.hpp"
 #include "ipcaster/base/Logger.hpp"
+#include "ipcaster/base/Platform.hpp"
 #include "ipcaster/net/Datagram.hpp"
-#include "ipcaster/net/UDPSender.hpp"
+#include "ipcaster/mpeg2-ts/MPEG2TSBuffer.hpp"
+#include "ipcaster/mpeg2-ts/MPEG2TSFilters.hpp"
+#include "ipcaster/smpte2022/SMPTE2022FEC.hpp"
+#include "ipcaster/net/UDPBurstSender.hpp"
+#include "ipcaster/net/PacketMMAPSender.hpp"
+#include "ipcaster/net/XDPSender.hpp"
+#include "ipcaster/net/UringSender.hpp"
+#include "ipcaster/net/SenderOptions.hpp"
 
 namespace ipcaster
 {
@@ -45,18 +59,26 @@ public:
      * Initializes the object. Launch the sender thread
      * 
      * @param burst_period The period the thread will wait between 
-     * sends in milliseconds, this will influence the size of minimum 
+     * sends in microseconds, this will influence the size of minimum 
      * burst send by the ethernet.
      * 
 	 * @param send_buffering_preroll The amount of stream (in time)
 	 * that is buffered before start sending
+     * 
+     * @param cpu CPU where the prepare and sender threads are pinned, -1 
+     * to let the OS schedule them
+     * 
+     * @param options Egress setup
 
      * @throws std::exception 
      */
-    DatagramsMuxer(std::chrono::milliseconds burst_period = std::chrono::milliseconds(4), std::chrono::milliseconds send_buffering_preroll = std::chrono::milliseconds(40)) :
+    DatagramsMuxer(std::chrono::microseconds burst_period = std::chrono::milliseconds(4), std::chrono::milliseconds send_buffering_preroll = std::chrono::milliseconds(40), int cpu = -1,
+        const SenderOptions& options = SenderOptions()) :
+        exit_threads_(false),
         timer_(burst_period), 
 		send_buffering_preroll_(send_buffering_preroll),
-        exit_threads_(false)
+        options_(options),
+        prepared_ring_(PREPARED_RING_CAPACITY)
     {
         send_stats_.max_prepare_ms = 0;
         send_stats_.max_send_ms = 0;
@@ -64,13 +86,44 @@ public:
         send_stats_.min_prepare_ms = std::numeric_limits<float>::max();
         send_stats_.min_send_ms = std::numeric_limits<float>::max();
         send_stats_.min_timer_ms = std::numeric_limits<float>::max();
+        send_stats_.max_syscalls = 0;
+        send_stats_.min_syscalls = std::numeric_limits<uint32_t>::max();
         send_stats_.high_burst_count_ = 0;
+        send_stats_.max_ring_occupancy = 0;
+        send_stats_.send_failures = 0;
+        send_stats_.min_submit_ms = std::numeric_limits<float>::max();
+        send_stats_.max_submit_ms = 0;
+        send_stats_.min_complete_ms = std::numeric_limits<float>::max();
+        send_stats_.max_complete_ms = 0;
+
+        txtime_lookahead_ = options.txtime_lookahead.count() ? options.txtime_lookahead : std::chrono::microseconds(2 * burst_period);
+
+        sender_ = createSender(options);
+
+        // The raw backends build their own frames, and the connected sockets have no SO_TXTIME
+        if(options_.connect && (sender_->txTimeEnabled() || 
+            options_.backend == SenderOptions::Backend::PACKET_MMAP || options_.backend == SenderOptions::Backend::XDP_SOCKET)) {
+            Logger::get().warning() << logclass(DatagramsMuxer) << "connected sockets are only supported by the UDP socket and io_uring backends without txtime" << std::endl;
+            options_.connect = false;
+        }
 
-		prepared_burst_.clear();
-        prepared_burst_spin.clear();
+        if(options_.fec_columns || options_.fec_rows) {
+            SMPTE2022Part1FECEncoder::validate(options_.fec_columns, options_.fec_rows);
+
+            // The FEC is computed when the datagrams are pushed, before the departure time is known
+            if(options_.pcr_restamp) {
+                Logger::get().warning() << logclass(DatagramsMuxer) << "PCR restamping can't be combined with FEC, disabled" << std::endl;
+                options_.pcr_restamp = false;
+            }
+        }
 
 		thread_prepare_ = std::thread(&DatagramsMuxer<Timer>::threadPrepare, this);
         thread_sender_ = std::thread(&DatagramsMuxer<Timer>::threadSender, this);
+
+        if(cpu >= 0) {
+            if(!setThreadAffinity(thread_prepare_, cpu) || !setThreadAffinity(thread_sender_, cpu))
+                Logger::get().warning() << logclass(DatagramsMuxer) << "couldn't pin threads to cpu " << cpu << std::endl;
+        }
     }
 
     /** Destructor
@@ -81,6 +134,13 @@ public:
     {
         exit_threads_ = true;
 
+        // Wake the producers waiting in Stream::close()
+        {
+            std::lock_guard<std::mutex> lock(mutex_streams_);
+            for(auto& stream : streams_)
+                stream->wakeClose();
+        }
+
         if(thread_sender_.joinable())
             thread_sender_.join();
 
@@ -99,12 +159,83 @@ public:
      * Has a fifo to store the datagrams until time to send is reached.
      * The endpoint for the datagrams is also an attribute of this class.
      */
-    class Stream 
+    class Stream : public std::enable_shared_from_this<Stream>
     {
 
     public:
 
+        // Buckets of the send lateness histogram: on time, < 1ms, < 2ms, < 4ms ... < 256ms, >= 256ms
+        static constexpr size_t LATENESS_BUCKETS = 11;
+
+        /** Late datagrams accounting of the stream */
+        struct LatenessStats
+        {
+            // Datagrams already late when prepared: the source / content couldn't keep up
+            uint64_t late_prepared;
+
+            // Datagrams dropped by the DROP policy
+            uint64_t dropped;
+
+            // Time base shifts of the RESYNC policy
+            uint64_t resyncs;
+
+            // Max time a datagram has been sent after its send tick: the host couldn't keep up
+            std::chrono::nanoseconds max_lateness;
+
+            // Datagrams sent per lateness bucket, see latenessBucketLimit()
+            std::array<uint64_t, LATENESS_BUCKETS> histogram;
+        };
+
+        /** 
+         * Compact form of a datagram queued in the stream. The payload isn't referenced by
+         * the descriptor, it lies in a block (the parent buffer of the payload) referenced
+         * by the stream once for all its datagrams, so the datagrams are queued, scheduled
+         * and sent without touching any reference count
+         */
+        struct DatagramDescriptor
+        {
+            // Payload, inside one of the stream blocks
+            uint8_t* data;
+            uint32_t size;
+
+            // Destination, owned by the stream
+            const ip::udp::endpoint* endpoint;
+
+            // Position of the datagram in the stream (number of datagrams pushed before it)
+            uint64_t sequence;
+
+            Clock::time_point send_tick;
+        };
+
+        // SMPTE 2022-7 paths
+        static constexpr size_t PRIMARY_PATH = 0;
+        static constexpr size_t SECONDARY_PATH = 1;
+
+        /** Send accounting of a SMPTE 2022-7 path */
+        struct PathStats
+        {
+            uint64_t datagrams;
+            uint64_t bytes;
+
+            // Max time a datagram has been sent after its send tick in the path
+            std::chrono::nanoseconds max_lateness;
+        };
+
+        /** @returns The upper limit (excluded) of a lateness histogram bucket, the last one has no limit */
+        static std::chrono::milliseconds latenessBucketLimit(size_t bucket)
+        {
+            if(bucket == 0)
+                return std::chrono::milliseconds(0);
+            if(bucket == LATENESS_BUCKETS - 1)
+                return std::chrono::milliseconds::max();
+
+            return std::chrono::milliseconds(1 << (bucket - 1));
+        }
+
         /** Constructor
+         * 
+         * The endpoint is resolved here, once per stream, so no address
+         * parsing is done per datagram
          * 
          * @param target_ip Target IP of the endpoint
          * 
@@ -112,21 +243,43 @@ public:
          * 
 		 *
 		 * @param parent Refence to the parent object
+         * 
+         * @param secondary_ip SMPTE 2022-7 secondary path target IP, empty if the stream has a single path
+         * 
+         * @param secondary_port SMPTE 2022-7 secondary path target port
+         * 
+         * @throws std::exception if target_ip or secondary_ip is not a valid address
          */
-        Stream(const std::string& target_ip, uint16_t target_port, DatagramsMuxer<Timer>& parent)
-            :   target_ip_(target_ip), 
-                target_port_(target_port), 
+        Stream(const std::string& target_ip, uint16_t target_port, DatagramsMuxer<Timer>& parent,
+            const std::string& secondary_ip = std::string(), uint16_t secondary_port = 0)
+            :   endpoint_(ip::address::from_string(target_ip), target_port), 
                 is_sync_point_set_(false),
                 is_start_point_set_(false),
                 tail_send_tick_(std::chrono::time_point<Clock>()),
+                estimated_bitrate_(0),
 				parent_(parent)
 
         {
             // Initial FIFO size, this size should be adjusted later by calling setBuffering
     		const uint32_t INITIAL_FIFO_DATAGRAMS_PER_STREAM = 100;
 
-            fifo_ = std::make_unique<FIFO<std::shared_ptr<Datagram>>>(INITIAL_FIFO_DATAGRAMS_PER_STREAM);
+            fifo_ = std::make_unique<FIFO<DatagramDescriptor>>(INITIAL_FIFO_DATAGRAMS_PER_STREAM);
+            blocks_ = std::make_unique<SPSCRing<Block>>(INITIAL_FIFO_DATAGRAMS_PER_STREAM + IN_FLIGHT_BLOCKS);
             last_popped_datagram_tick_.store(0, std::memory_order::memory_order_relaxed);
+
+            if(parent_.options_.fec_columns) {
+                if(target_port > std::numeric_limits<uint16_t>::max() - 4)
+                    throw Exception(fndbg(DatagramsMuxer) + "no room for the FEC ports after port " + std::to_string(target_port));
+
+                fec_ = std::make_unique<SMPTE2022Part1FECEncoder>(parent_.options_.fec_columns, parent_.options_.fec_rows);
+                fec_column_endpoint_ = ip::udp::endpoint(endpoint_.address(), target_port + 2);
+                fec_row_endpoint_ = ip::udp::endpoint(endpoint_.address(), target_port + 4);
+            }
+
+            if(!secondary_ip.empty()) {
+                secondary_endpoint_ = ip::udp::endpoint(ip::address::from_string(secondary_ip), secondary_port);
+                dual_path_ = true;
+            }
         }
 
         /** 
@@ -144,57 +297,301 @@ public:
                 is_sync_point_set_ = true;
             }
 
-            datagram->setTargetIP(target_ip_);
-            datagram->setTargetPort(target_port_);
-
-            fifo_->push(datagram); 
-            tail_send_tick_.store(datagram->sendTick());
+            if(fec_) {
+                fec_->push(datagram, [this](SMPTE2022Part1FECEncoder::Packet type, const std::shared_ptr<Datagram>& packet) { 
+                    enqueue(packet, fecEndpoint(type)); 
+                });
+            }
+            else
+                enqueue(datagram, &endpoint_);
         }
 
         /** 
-         * Pops the next datagram of the stream if the time of the datagram has expired
+         * Gets the (normalized to the DatagramsMuxer clock) send tick of the front datagram 
+         * 
+         * @param now The current time of the prepare horizon, used as start point when
+         * the preroll buffering is met
          * 
-         * @param now The current time of the send timer
+         * @param [out] tick The normalized send tick of the front datagram
          * 
-         * @returns The front datagram of the fifo if its send_tick < now, otherwise returns a void datagram
+         * @returns false if there's no datagram ready to be scheduled (empty fifo or
+         * preroll buffering not met), true otherwise
          */
-        std::shared_ptr<Datagram> popFrontDatagramElegible(const Clock::time_point& now)
+        bool frontSendTick(const Clock::time_point& now, Clock::time_point& tick)
         {
-            std::shared_ptr<Datagram> datagram;
-
-            if(fifo_->readAvailable()) {
-
-                if(!is_start_point_set_) {
-					// The send can be started if preroll buffering has been met
-					if (bufferedTime() >= parent_.send_buffering_preroll_) {
-						start_point_ = now;
-						is_start_point_set_ = true;
-					}
-					else
-						return datagram;
+            if(!fifo_->readAvailable())
+                return false;
+
+            if(!is_start_point_set_) {
+                // The send can be started if preroll buffering has been met, or
+                // if the producer won't push more to meet it
+                if (bufferedTime() >= parent_.send_buffering_preroll_ || draining_.load(std::memory_order_relaxed)) {
+                    start_point_ = now;
+                    is_start_point_set_ = true;
                 }
+                else
+                    return false;
+            }
+
+            // Slew of the drift control, measured by the sender thread
+            if(pending_slew_.load(std::memory_order_relaxed))
+                start_point_ += std::chrono::duration_cast<Clock::duration>(std::chrono::nanoseconds(pending_slew_.exchange(0, std::memory_order_relaxed)));
+
+            tick = fifo_->front().send_tick - sync_point_ + start_point_;
 
-                auto normalized_datagram_tick = fifo_->front()->sendTick() - sync_point_ + start_point_;
-                if(normalized_datagram_tick < now) {
-                    datagram = fifo_->front();
-                    fifo_->pop();
-                    last_popped_datagram_tick_.store(datagram->sendTick().time_since_epoch().count(), std::memory_order_relaxed);
-					datagram->setSendTick(normalized_datagram_tick);
+            // Per stream peak rate, not before the previous datagram has been sent at peak rate
+            if(parent_.options_.stream_peak_rate && tick < next_paced_tick_)
+                tick = next_paced_tick_;
+
+            // Late datagrams catch up at bounded overspeed, not before the previous one has been sent at that rate
+            if(tick < catchup_tick_)
+                tick = catchup_tick_;
+
+            return true;
+        }
+
+        /**
+         * Applies the late policy to the front datagram, if it's already late
+         * 
+         * @param [in,out] tick The normalized send tick of the front datagram, as returned by 
+         * frontSendTick(), the RESYNC policy shifts it
+         * 
+         * @param now Current time (not the prepare horizon)
+         * 
+         * @returns false if the datagram has to be dropped
+         * 
+         * @pre frontSendTick() returned true
+         */
+        bool applyLatePolicy(Clock::time_point& tick, const Clock::time_point& now)
+        {
+            // The lateness of the original schedule, not of the catch-up one
+            auto lateness = now - (fifo_->front().send_tick - sync_point_ + start_point_);
+            if(lateness <= Clock::duration(0))
+                return true;
+
+            late_prepared_.fetch_add(1, std::memory_order_relaxed);
+
+            const auto& options = parent_.options_;
+
+            switch(options.late_policy) {
+            case SenderOptions::LatePolicy::DROP:
+                if(lateness > options.late_threshold) {
+                    dropped_.fetch_add(1, std::memory_order_relaxed);
+                    return false;
+                }
+                break;
+
+            case SenderOptions::LatePolicy::RESYNC:
+                if(lateness > options.late_threshold) {
+                    start_point_ += lateness;
+                    tick += lateness;
+                    resyncs_.fetch_add(1, std::memory_order_relaxed);
                 }
+                break;
+
+            case SenderOptions::LatePolicy::CATCH_UP: {
+                // Unbounded without a factor or a bitrate, a tiny factor could round the rate to 0
+                auto catchup_bitrate = options.catchup_overspeed > 0 ? static_cast<uint64_t>(estimatedBitrate() * options.catchup_overspeed) : 0;
+                if(catchup_bitrate)
+                    catchup_tick_ = std::max(tick, now) + transmissionTime(fifo_->front().size, catchup_bitrate);
+                break;
+            }
+            }
+
+            return true;
+        }
+
+        /** 
+         * Accounts the lateness of a datagram of the stream being sent. 
+         * Called from the sender thread
+         * 
+         * @param lateness Send time minus send tick, negative if sent ahead (txtime)
+         */
+        void recordLateness(const Clock::duration& lateness)
+        {
+            size_t bucket = 0;
+
+            if(lateness > Clock::duration(0)) {
+                bucket = 1;
+                while(bucket < LATENESS_BUCKETS - 1 && lateness >= latenessBucketLimit(bucket))
+                    bucket++;
+
+                auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(lateness).count();
+                if(ns > max_lateness_.load(std::memory_order_relaxed))
+                    max_lateness_.store(ns, std::memory_order_relaxed);
             }
 
+            lateness_histogram_[bucket].fetch_add(1, std::memory_order_relaxed);
+        }
+
+        /** 
+         * Rewrites the PCRs of a datagram of the stream with its departure time. 
+         * Called from the sender thread just before the datagram is sent
+         */
+        inline void restampPCR(uint8_t* data, size_t size, const Clock::time_point& departure)
+        {
+            pcr_restamper_.restamp(data, size, departure.time_since_epoch());
+        }
+
+        /** @returns A snapshot of the late datagrams accounting */
+        LatenessStats latenessStats() const
+        {
+            LatenessStats stats;
+
+            stats.late_prepared = late_prepared_.load(std::memory_order_relaxed);
+            stats.dropped = dropped_.load(std::memory_order_relaxed);
+            stats.resyncs = resyncs_.load(std::memory_order_relaxed);
+            stats.max_lateness = std::chrono::nanoseconds(max_lateness_.load(std::memory_order_relaxed));
+            for(size_t i = 0; i < LATENESS_BUCKETS; i++)
+                stats.histogram[i] = lateness_histogram_[i].load(std::memory_order_relaxed);
+
+            return stats;
+        }
+
+        /** 
+         * Pops the front datagram of the stream 
+         * 
+         * @param tick The normalized send tick of the front datagram, as returned by frontSendTick()
+         * 
+         * @returns The front datagram of the fifo with its send tick normalized
+         * 
+         * @pre frontSendTick() returned true
+         */
+        DatagramDescriptor popFrontDatagram(const Clock::time_point& tick)
+        {
+            DatagramDescriptor datagram = fifo_->front();
+            fifo_->pop();
+            last_popped_datagram_tick_.store(datagram.send_tick.time_since_epoch().count(), std::memory_order_relaxed);
+            datagram.send_tick = tick;
+
+            if(parent_.options_.stream_peak_rate)
+                next_paced_tick_ = tick + transmissionTime(datagram.size, parent_.options_.stream_peak_rate);
+
             return datagram; 
         }
 
+        /** 
+         * Releases a datagram popped from the stream (sent or dropped), its block is released
+         * once all its datagrams are. Called from the sender thread, in stream order
+         */
+        inline void release()
+        {
+            auto released = released_.load(std::memory_order_relaxed) + 1;
+
+            // A block is done when the next one starts at a released datagram
+            while(blocks_->readAvailable() > 1 && blocks_->peek(1).first <= released)
+                blocks_->consume(1);
+
+            // seq_cst pairs with close(): either it sees the release or this sees its target.
+            // The release and the notify are the last touches of the stream, once close() 
+            // returns it's only destroyed by the sender thread (see onCloseStream())
+            released_.store(released, std::memory_order_seq_cst);
+
+            if(released >= close_target_.load(std::memory_order_seq_cst))
+                drained_.notify();
+        }
+
+        /** Wakes the producer waiting in close(), called when the DatagramsMuxer exits */
+        inline void wakeClose() { drained_.notify(); }
+
+        /** 
+         * @returns The block holding the payload of a datagram not released yet. 
+         * Called from the sender thread
+         */
+        const std::shared_ptr<Buffer>& block(uint64_t sequence)
+        {
+            size_t index = 0;
+            while(index + 1 < blocks_->readAvailable() && blocks_->peek(index + 1).first <= sequence)
+                index++;
+
+            return blocks_->peek(index).buffer;
+        }
+
+        /**
+         * Drift control loop, called from the sender thread for every datagram sent.
+         * The send offset (how late the datagram departs after its send tick) is
+         * normally below a burst period. If the min offset of a control window is above 
+         * that, the stream is falling behind its schedule, so instead of sending in catch-up 
+         * bursts, the mapping of the stream time (start_point_) is slewed by the excess, 
+         * bounded to max_drift_ppm of the window. The slew is applied by the prepare 
+         * thread, see frontSendTick()
+         * 
+         * @param offset Time the datagram departs after its normalized send tick
+         * 
+         * @param now The time the datagram is sent
+         */
+        void controlDrift(const Clock::duration& offset, const Clock::time_point& now)
+        {
+            if(drift_window_end_ == Clock::time_point()) {
+                drift_window_end_ = now + DRIFT_WINDOW;
+                window_min_offset_ = offset;
+            }
+
+            window_min_offset_ = std::min(window_min_offset_, offset);
+
+            if(now < drift_window_end_)
+                return;
+
+            auto excess = window_min_offset_ - parent_.timer_.period();
+            auto max_slew = std::chrono::duration_cast<Clock::duration>(std::chrono::nanoseconds(DRIFT_WINDOW) * parent_.options_.max_drift_ppm / 1000000);
+
+            if(excess > Clock::duration(0)) {
+                auto slew = std::min(excess, max_slew);
+                pending_slew_.fetch_add(std::chrono::duration_cast<std::chrono::nanoseconds>(slew).count(), std::memory_order_relaxed);
+                drift_.fetch_add(std::chrono::duration_cast<std::chrono::nanoseconds>(slew).count(), std::memory_order_relaxed);
+            }
+
+            // The stream falls behind faster than the max slew rate
+            bool saturated = excess > max_slew;
+            if(saturated != drift_saturated_) {
+                drift_saturated_ = saturated;
+                if(saturated)
+                    Logger::get().warning() << logclass(DatagramsMuxer) << "stream " << endpoint_ << " drifting faster than " 
+                        << parent_.options_.max_drift_ppm << "ppm, offset " << std::chrono::duration_cast<std::chrono::microseconds>(window_min_offset_).count() << "us" << std::endl;
+            }
+
+            schedule_offset_.store(std::chrono::duration_cast<std::chrono::nanoseconds>(window_min_offset_).count(), std::memory_order_relaxed);
+
+            drift_window_end_ = now + DRIFT_WINDOW;
+            window_min_offset_ = Clock::duration::max();
+        }
+
+        /** 
+         * @returns How much the stream time mapping has been slewed by the drift control, 
+         * i.e. how much later than its original schedule the stream is being sent
+         */
+        std::chrono::nanoseconds drift() const
+        {
+            return std::chrono::nanoseconds(drift_.load(std::memory_order_relaxed));
+        }
+
+        /** @returns The min schedule offset of the datagrams in the last drift control window */
+        std::chrono::nanoseconds scheduleOffset() const
+        {
+            return std::chrono::nanoseconds(schedule_offset_.load(std::memory_order_relaxed));
+        }
+
+        /** @returns true if the stream is drifting faster than the drift control can slew */
+        bool driftSaturated() const { return drift_saturated_; }
+
         /** 
          * Blocks until all the buffered data has been processed
          */
         void flush()
         {
+            if(fec_) {
+                fec_->flush([this](SMPTE2022Part1FECEncoder::Packet type, const std::shared_ptr<Datagram>& packet) { 
+                    enqueue(packet, fecEndpoint(type)); 
+                });
+            }
+
+            // A stream shorter than the preroll must start anyway
+            draining_.store(true, std::memory_order_relaxed);
+
             // Active wait is not the best way to do this, but for flush
             // a 100(ms) latency is tolerable, could be improved if
             // necesary
-            while(fifo_->readAvailable()) 
+            while(fifo_->readAvailable() && !parent_.exit_threads_) 
                 std::this_thread::sleep_for(std::chrono::milliseconds(100));
         }
 
@@ -205,6 +602,21 @@ public:
 		 */
 		void close()
 		{
+            // A stream shorter than the preroll must start anyway
+            draining_.store(true, std::memory_order_relaxed);
+
+            // The datagrams pushed are sent from the stream blocks, wait until the
+            // sender thread releases the last one
+            close_target_.store(pushed_, std::memory_order_seq_cst);
+            for(;;) {
+                auto key = drained_.prepareWait();
+                if(released_.load(std::memory_order_seq_cst) >= pushed_ || parent_.exit_threads_) {
+                    drained_.cancelWait();
+                    break;
+                }
+                drained_.wait(key);
+            }
+
 			parent_.onCloseStream(this);
 		}
 
@@ -222,18 +634,31 @@ public:
         */
         void setBuffering(size_t estimated_buffers_per_second, uint64_t estimated_bitrate)
         {
+            // The FEC packets share the fifo with the media datagrams
+            if(fec_)
+                estimated_buffers_per_second = static_cast<size_t>(estimated_buffers_per_second * fec_->overhead());
+
             // Capacity for 3 times the preroll (just in case)
             size_t fifo_needed_size = static_cast<size_t>(3 * estimated_buffers_per_second * parent_.send_buffering_preroll_.count() / 1000.0);
 
             // Change the fifo for a new one adjusted to stream buffering requirements
-            fifo_ = std::make_unique<FIFO<std::shared_ptr<Datagram>>>(fifo_needed_size);
+            fifo_ = std::make_unique<FIFO<DatagramDescriptor>>(fifo_needed_size);
+            blocks_ = std::make_unique<SPSCRing<Block>>(fifo_needed_size + IN_FLIGHT_BLOCKS);
+
+            estimated_bitrate_.store(estimated_bitrate, std::memory_order_relaxed);
+        }
+
+        /** @returns The bitrate estimated by the producer, 0 if unknown yet */
+        uint64_t estimatedBitrate() const
+        {
+            return estimated_bitrate_.load(std::memory_order_relaxed);
         }
 
         /** @returns The total amount of stream time (in milliseconds) buffered in the fifo */
         std::chrono::milliseconds bufferedTime()
         {
 			if (fifo_->readAvailable()) 
-				return std::chrono::duration_cast<std::chrono::milliseconds>(tail_send_tick_.load(std::memory_order_relaxed) - fifo_->front()->sendTick());
+				return std::chrono::duration_cast<std::chrono::milliseconds>(tail_send_tick_.load(std::memory_order_relaxed) - fifo_->front().send_tick);
             else
                 return std::chrono::milliseconds(0);
         }
@@ -255,17 +680,126 @@ public:
 
             return ret;
         }
+
+        /** @returns The destination of the stream datagrams */
+        inline const ip::udp::endpoint& endpoint() const { return endpoint_; }
+
+        /** @returns The socket connected to the stream endpoint, nullptr if not connected */
+        inline const std::shared_ptr<UDPSender>& connection() const { return connection_; }
+
+        /** Sets the socket connected to the stream endpoint, shared with the streams of the same endpoint */
+        inline void setConnection(std::shared_ptr<UDPSender> connection) { connection_ = connection; }
+
+        /** @returns true if the stream media is sent through two SMPTE 2022-7 paths */
+        inline bool dualPath() const { return dual_path_; }
+
+        /** @returns true if a datagram of the stream has to be sent through both paths (the FEC packets aren't) */
+        inline bool dualPath(const DatagramDescriptor& datagram) const { return dual_path_ && datagram.endpoint == &endpoint_; }
+
+        /** @returns The SMPTE 2022-7 secondary path destination */
+        inline const ip::udp::endpoint& secondaryEndpoint() const { return secondary_endpoint_; }
+
+        /** @returns The stream time buffered before the stream starts sending */
+        inline std::chrono::milliseconds sendBufferingPreroll() const { return parent_.send_buffering_preroll_; }
+
+        /** @returns The socket connected to the secondary endpoint, nullptr if not connected */
+        inline const std::shared_ptr<UDPSender>& secondaryConnection() const { return secondary_connection_; }
+
+        /** Sets the socket connected to the secondary endpoint */
+        inline void setSecondaryConnection(std::shared_ptr<UDPSender> connection) { secondary_connection_ = connection; }
+
+        /** Accounts a datagram sent through a path, called from the sender thread */
+        inline void recordPathSend(size_t path, size_t bytes, const Clock::duration& lateness)
+        {
+            path_datagrams_[path].fetch_add(1, std::memory_order_relaxed);
+            path_bytes_[path].fetch_add(bytes, std::memory_order_relaxed);
+
+            auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(lateness).count();
+            if(ns > path_max_lateness_[path].load(std::memory_order_relaxed))
+                path_max_lateness_[path].store(ns, std::memory_order_relaxed);
+        }
+
+        /** @returns A snapshot of the send accounting of a path */
+        PathStats pathStats(size_t path) const
+        {
+            PathStats stats;
+            stats.datagrams = path_datagrams_[path].load(std::memory_order_relaxed);
+            stats.bytes = path_bytes_[path].load(std::memory_order_relaxed);
+            stats.max_lateness = std::chrono::nanoseconds(path_max_lateness_[path].load(std::memory_order_relaxed));
+            return stats;
+        }
+
+        /** @returns The socket connected to the destination of a datagram of the stream, nullptr if none */
+        inline UDPSender* connection(const DatagramDescriptor& datagram) const 
+        { 
+            return datagram.endpoint == &endpoint_ ? connection_.get() : nullptr; 
+        }
         
     private:
 
-        std::string target_ip_;
+        // Destination of all the stream datagrams, resolved at construction
+        ip::udp::endpoint endpoint_;
+
+        // SMPTE 2022-1 FEC generator, nullptr if FEC is disabled
+        std::unique_ptr<SMPTE2022Part1FECEncoder> fec_;
+
+        // Destinations of the column and row FEC packets (port + 2 and port + 4)
+        ip::udp::endpoint fec_column_endpoint_;
+        ip::udp::endpoint fec_row_endpoint_;
+
+        // SMPTE 2022-7, the media datagrams are also sent to secondary_endpoint_
+        bool dual_path_ = false;
+        ip::udp::endpoint secondary_endpoint_;
+
+        // Socket connected to secondary_endpoint_, if connected sockets are enabled
+        std::shared_ptr<UDPSender> secondary_connection_;
+
+        // Per path send accounting, updated by the sender thread
+        std::array<std::atomic<uint64_t>, 2> path_datagrams_{};
+        std::array<std::atomic<uint64_t>, 2> path_bytes_{};
+        std::array<std::atomic<int64_t>, 2> path_max_lateness_{};
+
+        // Socket connected to endpoint_, if connected sockets are enabled
+        std::shared_ptr<UDPSender> connection_;
+
+        std::unique_ptr<FIFO<DatagramDescriptor>> fifo_;
+
+        // Buffer holding the payloads of consecutive datagrams of the stream, and the sequence of the first one
+        struct Block
+        {
+            std::shared_ptr<Buffer> buffer;
+            uint64_t first;
+        };
+
+        // Blocks of the datagrams not released yet, pushed by the producer and released by the sender thread
+        std::unique_ptr<SPSCRing<Block>> blocks_;
+
+        // Room of blocks_ for the blocks of the datagrams already popped from the fifo
+        static const size_t IN_FLIGHT_BLOCKS = 1024;
+
+        // Last block pushed, only used by the producer
+        const Buffer* last_block_ = nullptr;
+
+        // Datagrams pushed, only used by the producer
+        uint64_t pushed_ = 0;
 
-        uint16_t target_port_;
+        // Datagrams released by the sender thread
+        std::atomic<uint64_t> released_{0};
 
-        std::unique_ptr<FIFO<std::shared_ptr<Datagram>>> fifo_;
+        // Datagrams to release before close() returns, set by the producer in close()
+        std::atomic<uint64_t> close_target_{UINT64_MAX};
+
+        // Notified when released_ reaches close_target_ or the DatagramsMuxer exits
+        EventCount drained_;
+
+        // Set when the producer flushes or closes, the send starts without the preroll buffering
+        std::atomic<bool> draining_{false};
 
         // Send tick of last datagram in the fifo
         std::atomic<Clock::time_point> tail_send_tick_;
+
+        // Bitrate estimated by the producer in setBuffering
+        std::atomic<uint64_t> estimated_bitrate_;
         
         // If false the base time for the stream will be synched to the DatagramMuxer 
         // timer clock when next datagram arrives
@@ -280,12 +814,78 @@ public:
         // The time (DatagramsMuxer clock) of the first datagram of the stream
         Clock::time_point start_point_;
 
+        // Earliest send tick of the next datagram to comply with the stream peak rate
+        Clock::time_point next_paced_tick_;
+
         // Last popped datagram time
         std::atomic<Clock::time_point::rep> last_popped_datagram_tick_;
 
+        // Drift control window length
+        static constexpr std::chrono::seconds DRIFT_WINDOW = std::chrono::seconds(1);
+
+        // End of the current drift control window, and min schedule offset seen in it
+        Clock::time_point drift_window_end_;
+        Clock::duration window_min_offset_;
+
+        // Slew of start_point_ requested by the drift control and not applied yet (nanoseconds)
+        std::atomic<int64_t> pending_slew_{0};
+
+        // Accumulated slew of start_point_ and min offset of the last window (nanoseconds), for reporting
+        std::atomic<int64_t> drift_{0};
+        std::atomic<int64_t> schedule_offset_{0};
+
+        // Falling behind faster than max_drift_ppm
+        std::atomic<bool> drift_saturated_{false};
+
+        // Earliest send tick of the next datagram catching up (CATCH_UP policy)
+        Clock::time_point catchup_tick_;
+
+        // Late datagrams accounting, see LatenessStats
+        std::atomic<uint64_t> late_prepared_{0};
+        std::atomic<uint64_t> dropped_{0};
+        std::atomic<uint64_t> resyncs_{0};
+        std::atomic<int64_t> max_lateness_{0};
+        std::array<std::atomic<uint64_t>, LATENESS_BUCKETS> lateness_histogram_{};
+
+        // Rewrites the PCRs at departure time, only used by the sender thread
+        PCRRestamper pcr_restamper_;
+
 		// Parent reference
 		DatagramsMuxer& parent_;
 
+        /** Enqueues a datagram to be sent to one of the stream destinations */
+        inline void enqueue(const std::shared_ptr<Datagram>& datagram, const ip::udp::endpoint* endpoint)
+        {
+            auto& payload = datagram->payload();
+
+            // The datagrams carved from the same parent buffer share its block
+            auto& block = payload->parent() ? payload->parent() : payload;
+            if(block.get() != last_block_) {
+                // All the blocks are in use by datagrams not sent yet
+                while(!blocks_->push({block, pushed_}))
+                    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+                last_block_ = block.get();
+            }
+
+            fifo_->push({static_cast<uint8_t*>(payload->data()), static_cast<uint32_t>(payload->size()), endpoint, pushed_, datagram->sendTick()}); 
+            pushed_++;
+            tail_send_tick_.store(datagram->sendTick());
+        }
+
+        /** @returns The destination of a packet output by the FEC generator */
+        inline const ip::udp::endpoint* fecEndpoint(SMPTE2022Part1FECEncoder::Packet type) const
+        {
+            switch(type) {
+                case SMPTE2022Part1FECEncoder::Packet::COLUMN_FEC:
+                    return &fec_column_endpoint_;
+                case SMPTE2022Part1FECEncoder::Packet::ROW_FEC:
+                    return &fec_row_endpoint_;
+                default:
+                    return &endpoint_;
+            }
+        }
+
     }; // DatagramsMuxter::Stream
 
     /** @returns A vector of references to the streams of the DatagramsMuxer */
@@ -303,38 +903,154 @@ public:
      * 
      * @param target_port Destination port for all the datagrams pushed to the stream
      * 
+     * @param secondary_ip SMPTE 2022-7 secondary destination IP, empty for a single path stream
+     * 
+     * @param secondary_port SMPTE 2022-7 secondary destination port
+     * 
      * @returns A reference to the new stream
+     * 
+     * @throws std::exception If an address is not valid or the backend can't send to it
      */
-    std::shared_ptr<Stream> createStream(const std::string& target_ip, uint16_t target_port)
+    std::shared_ptr<Stream> createStream(const std::string& target_ip, uint16_t target_port, 
+        const std::string& secondary_ip = std::string(), uint16_t secondary_port = 0)
     {
         std::lock_guard<std::mutex> lock(mutex_streams_);
 
-        streams_.push_back(std::make_shared<Stream>(target_ip, target_port, *this));
+        auto stream = std::make_shared<Stream>(target_ip, target_port, *this, secondary_ip, secondary_port);
+
+        sender_->addDestination(stream->endpoint().address());
+        if(stream->dualPath())
+            sender_->addDestination(stream->secondaryEndpoint().address());
+
+        streams_.push_back(stream);
+
+        if(options_.connect) {
+            streams_.back()->setConnection(connection(streams_.back()->endpoint()));
+            if(streams_.back()->dualPath())
+                streams_.back()->setSecondaryConnection(connection(streams_.back()->secondaryEndpoint()));
+        }
+
+        // The stream has nothing to schedule yet
+        idle_streams_.push_back(streams_.back().get());
 
         return streams_.back();
     }
 
-    /** @returns A string with sending statistics */
-    std::string stats() 
+    /** Snapshot of the send timing statistics */
+    struct SendStats
     {
-        char str[1024];
+        // false until the first burst period has been measured
+        bool valid;
+
+        float min_timer_ms;
+        float max_timer_ms;
+        float min_prepare_ms;
+        float max_prepare_ms;
+        float min_send_ms;
+        float max_send_ms;
+        uint32_t min_syscalls;
+        uint32_t max_syscalls;
+        uint32_t high_burst_count;
+        // Max fraction of the backend transmit ring used by a burst (0 if the backend has no ring)
+        float max_ring_occupancy;
+        // Datagrams the backend couldn't send
+        uint64_t send_failures;
+        // Asynchronous backends, burst submission and completion latencies (max 0 if synchronous)
+        float min_submit_ms;
+        float max_submit_ms;
+        float min_complete_ms;
+        float max_complete_ms;
+
+        /** Accumulates other stats into these ones (min of mins, max of maxs, sum of counters) */
+        void merge(const SendStats& other)
+        {
+            if(!other.valid)
+                return;
 
-        // if stats are initialized
-        if(send_stats_.max_timer_ms.load() > 0.001) {
-            snprintf(str, sizeof(str), "timer(ms) [%.3f,%.3f] prepare [%.3f,%.3f] send [%.3f,%.3f] highburst %u", 
-                send_stats_.min_timer_ms.load(std::memory_order_relaxed),
-                send_stats_.max_timer_ms.load(std::memory_order_relaxed),
-                send_stats_.min_prepare_ms.load(std::memory_order_relaxed),
-                send_stats_.max_prepare_ms.load(std::memory_order_relaxed),
-                send_stats_.min_send_ms.load(std::memory_order_relaxed),
-                send_stats_.max_send_ms.load(std::memory_order_relaxed),
-                send_stats_.high_burst_count_.load(std::memory_order_relaxed));
-        }
-        else {
-            str[0] = 0;
+            if(!valid) {
+                *this = other;
+                return;
+            }
+
+            min_timer_ms = std::min(min_timer_ms, other.min_timer_ms);
+            max_timer_ms = std::max(max_timer_ms, other.max_timer_ms);
+            min_prepare_ms = std::min(min_prepare_ms, other.min_prepare_ms);
+            max_prepare_ms = std::max(max_prepare_ms, other.max_prepare_ms);
+            min_send_ms = std::min(min_send_ms, other.min_send_ms);
+            max_send_ms = std::max(max_send_ms, other.max_send_ms);
+            min_syscalls = std::min(min_syscalls, other.min_syscalls);
+            max_syscalls = std::max(max_syscalls, other.max_syscalls);
+            high_burst_count += other.high_burst_count;
+            max_ring_occupancy = std::max(max_ring_occupancy, other.max_ring_occupancy);
+            send_failures += other.send_failures;
+            min_submit_ms = std::min(min_submit_ms, other.min_submit_ms);
+            max_submit_ms = std::max(max_submit_ms, other.max_submit_ms);
+            min_complete_ms = std::min(min_complete_ms, other.min_complete_ms);
+            max_complete_ms = std::max(max_complete_ms, other.max_complete_ms);
         }
-        
-        return str;
+
+        /** @returns A string with the statistics, empty if not valid */
+        std::string str() const
+        {
+            char str[1024];
+
+            if(valid) {
+                int len = snprintf(str, sizeof(str), "timer(ms) [%.3f,%.3f] prepare [%.3f,%.3f] send [%.3f,%.3f]", 
+                    min_timer_ms, max_timer_ms,
+                    min_prepare_ms, max_prepare_ms,
+                    min_send_ms, max_send_ms);
+
+                if(max_complete_ms > 0)
+                    len += snprintf(str + len, sizeof(str) - len, " submit [%.3f,%.3f] complete [%.3f,%.3f]",
+                        min_submit_ms, max_submit_ms,
+                        min_complete_ms, max_complete_ms);
+
+                len += snprintf(str + len, sizeof(str) - len, " syscalls [%u,%u] highburst %u failures %llu", 
+                    min_syscalls, max_syscalls,
+                    high_burst_count,
+                    static_cast<unsigned long long>(send_failures));
+
+                if(max_ring_occupancy > 0)
+                    snprintf(str + len, sizeof(str) - len, " txring %.2f%%", max_ring_occupancy * 100);
+            }
+            else {
+                str[0] = 0;
+            }
+
+            return str;
+        }
+    };
+
+    /** @returns A snapshot of the sending statistics */
+    SendStats getSendStats()
+    {
+        SendStats stats;
+
+        // if stats are initialized
+        stats.valid = send_stats_.max_timer_ms.load() > 0.001;
+        stats.min_timer_ms = send_stats_.min_timer_ms.load(std::memory_order_relaxed);
+        stats.max_timer_ms = send_stats_.max_timer_ms.load(std::memory_order_relaxed);
+        stats.min_prepare_ms = send_stats_.min_prepare_ms.load(std::memory_order_relaxed);
+        stats.max_prepare_ms = send_stats_.max_prepare_ms.load(std::memory_order_relaxed);
+        stats.min_send_ms = send_stats_.min_send_ms.load(std::memory_order_relaxed);
+        stats.max_send_ms = send_stats_.max_send_ms.load(std::memory_order_relaxed);
+        stats.min_syscalls = send_stats_.min_syscalls.load(std::memory_order_relaxed);
+        stats.max_syscalls = send_stats_.max_syscalls.load(std::memory_order_relaxed);
+        stats.high_burst_count = send_stats_.high_burst_count_.load(std::memory_order_relaxed);
+        stats.max_ring_occupancy = send_stats_.max_ring_occupancy.load(std::memory_order_relaxed);
+        stats.send_failures = send_stats_.send_failures.load(std::memory_order_relaxed);
+        stats.min_submit_ms = send_stats_.min_submit_ms.load(std::memory_order_relaxed);
+        stats.max_submit_ms = send_stats_.max_submit_ms.load(std::memory_order_relaxed);
+        stats.min_complete_ms = send_stats_.min_complete_ms.load(std::memory_order_relaxed);
+        stats.max_complete_ms = send_stats_.max_complete_ms.load(std::memory_order_relaxed);
+
+        return stats;
+    }
+
+    /** @returns A string with sending statistics */
+    std::string stats() 
+    {
+        return getSendStats().str();
     }
 
     /**
@@ -384,7 +1100,7 @@ private:
 	std::thread thread_prepare_;
 
     // When true the thread_sender exits 
-    bool exit_threads_;
+    std::atomic<bool> exit_threads_;
 
     // Streams added to the DatagramsMuxer
     std::vector<std::shared_ptr<Stream>> streams_;
@@ -392,11 +1108,22 @@ private:
     // Mutex for the streams_ vector
     std::mutex mutex_streams_;
 
+    // Streams closed by their producer, destroyed by the sender thread out of release().
+    // Guarded by mutex_streams_
+    std::vector<std::shared_ptr<Stream>> closed_streams_;
+
+    // Set when closed_streams_ isn't empty, checked by the sender thread without locking
+    std::atomic<bool> streams_closed_{false};
+
+    // Sockets connected to the streams endpoints, one per endpoint, alive while some 
+    // stream or prepared datagram uses them. Guarded by mutex_streams_
+    std::map<ip::udp::endpoint, std::weak_ptr<UDPSender>> connections_;
+
     // The thread_sender_ waits on this timer to time the datagram burst sending
     Timer timer_;
 
-    // Sender UDP socket
-    UDPSender sender_;
+    // Egress backend, sends every burst with the minimum number of syscalls
+    std::unique_ptr<BurstSender> sender_;
 
     // For send timming statistics purposes
     Clock::time_point t_last_burst_;
@@ -409,45 +1136,194 @@ private:
 	// Indicates amount of time of the stream that is buffered before start sending
 	std::chrono::milliseconds send_buffering_preroll_;
 
+    // Egress setup
+    SenderOptions options_;
+
+    // In txtime mode, how far ahead of its send tick a datagram is passed to the kernel
+    std::chrono::microseconds txtime_lookahead_;
+
+    // Earliest send tick of the next datagram to comply with the aggregated peak rate
+    Clock::time_point next_aggregate_tick_;
+
 	// Condition to wake-up prepareThread
 	std::condition_variable prepare_cv_;
 	bool event_prepare_;
 	std::mutex prepare_cv_mutex_;
 
     /** 
-     * A vector of datagrams references and their endpoints that will
-     * be send in a burst (at a time)
+     * A datagram already popped from its stream, and its endpoint, 
+     * waiting to be sent
      */
-    struct Burst
+    struct PreparedDatagram
     {
-		struct Element
-		{
-			std::shared_ptr<Datagram> datagram;
-			ip::udp::endpoint endpoint;
-		};
+        // Payload, inside a block of the stream (see Stream::DatagramDescriptor)
+        uint8_t* data;
+        uint32_t size;
 
-        std::vector<Element> elements;
-        
+        // Position of the datagram in its stream
+        uint64_t sequence;
+
+        Clock::time_point send_tick;
+
+        // Destination, owned by the stream
+        const ip::udp::endpoint* endpoint;
+
+        // Socket connected to the endpoint, nullptr to use the sender one
+        UDPSender* connection;
+
+        // Stream of the datagram, it isn't closed until all its datagrams are released
+        Stream* stream;
+
+        // SMPTE 2022-7, the datagram is also sent to the stream secondary endpoint
+        bool dual_path;
+
+        // Dropped by the late policy, it's only released
+        bool dropped;
+    };
+
+    /** 
+     * The datagrams that will be send in a burst (at a time). The datagrams
+     * are not copied, the burst is formed by the "count" front elements of 
+     * prepared_ring_
+     */
+    struct Burst
+    {
+        // Datagrams of the prepared ring
+        size_t count;
         size_t size;
-        inline void clear() { elements.clear(); size = 0; }
+        // Secondary path datagrams of the skew delay line
+        size_t skewed;
+        inline void clear() { count = 0; size = 0; skewed = 0; }
     };
 
-	// Burst ready already popped from the streams and ready to send
-	Burst prepared_burst_;
+    // SMPTE 2022-7 secondary path datagram delayed by the path skew. The datagrams of 
+    // the stream not sent through the secondary path go through the delay line too, so 
+    // the stream releases its datagrams in order
+    struct SkewedDatagram
+    {
+        uint8_t* data;
+        uint32_t size;
+        uint64_t sequence;
+        Stream* stream;
+        Clock::time_point send_tick;
+
+        // false if the datagram is only released
+        bool secondary;
+    };
+
+    // Secondary path datagrams waiting for their send tick, only used by the sender thread
+    std::deque<SkewedDatagram> skewed_;
+
+    // Max number of prepared datagrams waiting to be sent (for all the streams)
+    static const size_t PREPARED_RING_CAPACITY = 65536;
+
+    // Datagrams prepared (in deadline order) by threadPrepare and consumed by threadSender
+    SPSCRing<PreparedDatagram> prepared_ring_;
+
+    // Scheduling entry, the next send tick of a stream
+    struct ScheduleEntry
+    {
+        Clock::time_point tick;
+        Stream* stream;
+
+        // Min-heap ordering (std heap algorithms build a max-heap)
+        inline bool operator<(const ScheduleEntry& other) const { return tick > other.tick; }
+    };
+
+    // Min-heap of the streams with a datagram ready to be scheduled, ordered by send tick
+    std::vector<ScheduleEntry> schedule_;
+
+    // Streams with nothing to schedule (empty fifo or preroll not met), polled on every prepare
+    std::vector<Stream*> idle_streams_;
+
+
+    /** 
+     * Creates the egress backend selected in the options 
+     * 
+     * @throws std::exception if the backend can't be created
+     */
+    std::unique_ptr<BurstSender> createSender(const SenderOptions& options)
+    {
+        if(options.backend != SenderOptions::Backend::UDP_SOCKET) {
+            if(options.txtime || options.gso || options.zerocopy)
+                Logger::get().warning() << logclass(DatagramsMuxer) << "txtime, GSO and zerocopy are only supported by the UDP socket backend" << std::endl;
+
+            if(options.backend == SenderOptions::Backend::IO_URING)
+                return std::make_unique<UringSender>();
+
+            if(options.backend == SenderOptions::Backend::XDP_SOCKET)
+                return std::make_unique<XDPSender>(options.interface, options.xdp_queue);
 
-	// Spinlock to access prepared_burst_
-	std::atomic_flag prepared_burst_spin;
+            return std::make_unique<PacketMMAPSender>(options.interface);
+        }
+
+        auto sender = std::make_unique<UDPBurstSender>();
+
+        if(options.txtime && !sender->enableTxTime())
+            Logger::get().warning() << logclass(DatagramsMuxer) << "SO_TXTIME not supported, falling back to timer driven send" << std::endl;
+
+        if(options.gso && !sender->enableGSO())
+            Logger::get().warning() << logclass(DatagramsMuxer) << "UDP GSO not supported, sending every datagram on its own" << std::endl;
+
+        if(options.zerocopy && !sender->enableZeroCopy())
+            Logger::get().warning() << logclass(DatagramsMuxer) << "MSG_ZEROCOPY not supported, copying the datagrams" << std::endl;
+        else if(options.zerocopy && options.connect)
+            Logger::get().warning() << logclass(DatagramsMuxer) << "zerocopy is not applied to the connected sockets" << std::endl;
+
+        return sender;
+    }
+
+    /** 
+     * Gets the socket connected to an endpoint, shared by all its streams. 
+     * Must be called with mutex_streams_ locked
+     * 
+     * @throws UDPSender::SystemError if the socket can't be connected
+     */
+    std::shared_ptr<UDPSender> connection(const ip::udp::endpoint& endpoint)
+    {
+        auto& entry = connections_[endpoint];
+        auto connection = entry.lock();
+
+        if(!connection) {
+            connection = std::make_shared<UDPSender>();
+            connection->connect(endpoint);
+            entry = connection;
+        }
+
+        // Forget the sockets already released
+        for(auto it = connections_.begin(); it != connections_.end();) {
+            if(it->second.expired())
+                it = connections_.erase(it);
+            else
+                ++it;
+        }
+
+        return connection;
+    }
 
 	/**
-	 * Removes the stream from the streams vector
+	 * Removes the stream from the streams vector and from the scheduler
+	 * 
+	 * The stream is kept in closed_streams_ until the sender thread destroys it, as
+	 * the sender thread can still be inside the release() of its last datagram
 	 */
 	void onCloseStream(Stream* stream)
 	{
 		std::lock_guard<std::mutex> lock(mutex_streams_);
 
+        idle_streams_.erase(std::remove(idle_streams_.begin(), idle_streams_.end(), stream), idle_streams_.end());
+
+        auto scheduled = std::remove_if(schedule_.begin(), schedule_.end(), [&](const ScheduleEntry& entry) { return entry.stream == stream; });
+        if(scheduled != schedule_.end()) {
+            schedule_.erase(scheduled, schedule_.end());
+            std::make_heap(schedule_.begin(), schedule_.end());
+        }
+
 		for (auto it = streams_.cbegin(); it != streams_.cend(); it++) {
 			if ((*it).get() == stream) {
+                closed_streams_.push_back(*it);
 				streams_.erase(it);
+                streams_closed_.store(true, std::memory_order_release);
 				return;
 			}
 		}
@@ -455,10 +1331,22 @@ private:
 		assert(false); // this should never execute
 	}
 
+    /** Destroys the closed streams, called from the sender thread between bursts */
+    void destroyClosedStreams()
+    {
+        std::vector<std::shared_ptr<Stream>> closed;
+
+        {
+            std::lock_guard<std::mutex> lock(mutex_streams_);
+            closed.swap(closed_streams_);
+            streams_closed_.store(false, std::memory_order_relaxed);
+        }
+    }
+
     /** 
      * Main loop of the sending process:
      * - Waits for an interrupt from the timer.
-     * - Send a burst from the "prepared_burst_" with all datagrams which 
+     * - Send a burst from the "prepared_ring_" with all datagrams which 
 	 * - Awakes threadPrepare.
      * send_tick < now.
      */
@@ -472,18 +1360,35 @@ private:
 
             auto now = timer_.wait();
 
-			getSendBurst(now, burst);
-            auto t_prepare = Clock::now();
+            size_t syscalls;
+            Clock::time_point t_prepare;
+            Clock::time_point t_send;
+
+            if(options_.pacing && !sender_->txTimeEnabled()) {
+                Clock::duration prepare_time;
+                Clock::duration send_time;
+                syscalls = sendPacedBurst(now, burst, prepare_time, send_time);
+                // The burst is sent in several slices, the stats account the accumulated times
+                t_prepare = now + prepare_time;
+                t_send = t_prepare + send_time;
+            }
+            else {
+                getSendBurst(now, burst);
+                t_prepare = Clock::now();
 
-            sendBurst(burst);
-            auto t_send = Clock::now();
+                syscalls = sendBurst(burst);
+                t_send = Clock::now();
+            }
 
-            if(burst.elements.size() > 0)
-                keepSendStats(now, t_last_burst_, t_prepare, t_send, burst);
+            if(burst.count > 0)
+                keepSendStats(now, t_last_burst_, t_prepare, t_send, syscalls, burst);
 
             burst.clear();
             t_last_burst_ = now;
 
+            if(streams_closed_.load(std::memory_order_acquire))
+                destroyClosedStreams();
+
 			std::lock_guard <std::mutex> lock(prepare_cv_mutex_);
 			event_prepare_ = true;
 			prepare_cv_.notify_one();
@@ -494,9 +1399,9 @@ private:
 	 * Main loop of the preparing process:
 	 * After every sending this thread is awaken.
 	 * The thread look in the streams, gather new datagrams to be
-	 * sent and adds them to "prepared_burst_".
+	 * sent and adds them to "prepared_ring_".
 	 * The idea is to have "send_buffering_preroll_" milliseconds
-	 * always buffered in "prepared_burst", so "send_buffering_preroll_" 
+	 * always buffered in "prepared_ring_", so "send_buffering_preroll_" 
 	 * should be several times lower than "burst_period" to asure there will always 
 	 * be buffered stream when the threadSender awakes to send
 	 * the next burst
@@ -519,81 +1424,302 @@ private:
 	}
 
 	/**
-	 * Extract datagrams from the streams and stores them in
-	 * prepared_burst_
+	 * Gathers from the front of prepared_ring_ the datagrams with send_tick < now
+     * and queues them in the sender. The datagrams stay in the ring until 
+     * sendBurst() has sent them.
 	 */
 	void getSendBurst(const Clock::time_point& now, Burst& send_burst)
 	{
-		while (prepared_burst_spin.test_and_set(std::memory_order_acquire));  // acquire lock
-
-        auto last_selected_element = prepared_burst_.elements.cend();
-		// Gather the datagrams with send_tick < now
-		for (auto element = prepared_burst_.elements.cbegin(); element != prepared_burst_.elements.cend(); element++) {
-			if (element->datagram->sendTick() < now) {
-                last_selected_element = element;
-				send_burst.elements.push_back(*element);
-				send_burst.size += element->datagram->payload()->size();
-			}
-			else {
-				// The first element <= now breaks the loop
+        auto available = prepared_ring_.readAvailable();
+        auto horizon = now;
+        std::chrono::nanoseconds monotonic_offset(0);
+
+        // In txtime mode the datagrams are passed to the kernel ahead of time, the 
+        // qdisc will release them at their send tick (in CLOCK_MONOTONIC time)
+        if(sender_->txTimeEnabled()) {
+            horizon += txtime_lookahead_;
+            monotonic_offset = std::chrono::steady_clock::now().time_since_epoch() - Clock::now().time_since_epoch();
+        }
+
+        // The kernel may still be transmitting from the payloads after the burst is sent
+        auto zerocopy = sender_->zeroCopyEnabled();
+
+        // Secondary path datagrams due, delayed by the path skew
+        while(send_burst.skewed < skewed_.size()) {
+            auto& element = skewed_[send_burst.skewed];
+
+            if(element.send_tick >= horizon)
+                break;
+
+            if(element.secondary)
+                pushSecondaryPath(*element.stream, element.data, element.size, element.sequence, element.send_tick, now, monotonic_offset, send_burst);
+            send_burst.skewed++;
+        }
+
+		while (send_burst.count < available) {
+            auto& element = prepared_ring_.peek(send_burst.count);
+
+            if(element.dropped) {
+                if(skewedRelease(*element.stream))
+                    skewed_.push_back({element.data, element.size, element.sequence, element.stream, element.send_tick + options_.path_skew, false});
+                send_burst.count++;
+                continue;
+            }
+
+            auto send_tick = pacedTick(element.send_tick);
+
+            // The datagrams are in deadline order so the first not elegible breaks the loop
+			if (send_tick >= horizon)
 				break; 
-			}
-		}
 
-        // remove the datagrams selected to be sent from the prepared burst
-        if(last_selected_element != prepared_burst_.elements.cend())
-            prepared_burst_.elements.erase(prepared_burst_.elements.cbegin(), last_selected_element+1);
+            auto txtime = std::chrono::duration_cast<std::chrono::nanoseconds>(send_tick.time_since_epoch() + monotonic_offset).count();
+
+            element.stream->recordLateness(now - send_tick);
+
+            if(options_.max_drift_ppm)
+                element.stream->controlDrift(std::max(send_tick, now) - element.send_tick, now);
+
+            // The datagram departs at its send tick (txtime, pacing) or right now if it's already due
+            if(options_.pcr_restamp)
+                element.stream->restampPCR(element.data, element.size, std::max(send_tick, now));
 
-		prepared_burst_spin.clear(std::memory_order_release); // release lock
+            commitPacedTick(send_tick, element.size);
+            sender_->push(*element.endpoint, element.data, element.size, static_cast<uint64_t>(txtime),
+                element.connection ? element.connection->nativeHandle() : -1);
+            if(zerocopy)
+                sender_->pin(element.stream->block(element.sequence));
+            send_burst.size += element.size;
+            send_burst.count++;
+
+            // SMPTE 2022-7, the same payload is sent through the secondary path
+            if(element.dual_path)
+                element.stream->recordPathSend(Stream::PRIMARY_PATH, element.size, now - send_tick);
+
+            if(skewedRelease(*element.stream))
+                skewed_.push_back({element.data, element.size, element.sequence, element.stream, send_tick + options_.path_skew, element.dual_path});
+            else if(element.dual_path)
+                pushSecondaryPath(*element.stream, element.data, element.size, element.sequence, send_tick, now, monotonic_offset, send_burst);
+		}
 	}
 
+    /**
+     * Queues a datagram in the sender to the secondary path of a SMPTE 2022-7 stream.
+     * The secondary path isn't accounted by the aggregated peak rate
+     */
+    inline void pushSecondaryPath(Stream& stream, uint8_t* data, size_t size, uint64_t sequence, const Clock::time_point& send_tick, 
+        const Clock::time_point& now, const std::chrono::nanoseconds& monotonic_offset, Burst& send_burst)
+    {
+        auto txtime = std::chrono::duration_cast<std::chrono::nanoseconds>(send_tick.time_since_epoch() + monotonic_offset).count();
+
+        sender_->push(stream.secondaryEndpoint(), data, size, static_cast<uint64_t>(txtime),
+            stream.secondaryConnection() ? stream.secondaryConnection()->nativeHandle() : -1);
+        if(sender_->zeroCopyEnabled())
+            sender_->pin(stream.block(sequence));
+
+        stream.recordPathSend(Stream::SECONDARY_PATH, size, now - send_tick);
+        send_burst.size += size;
+    }
+
+    /** 
+     * @returns true if the datagrams of the stream are released from the skew delay line
+     * (SMPTE 2022-7 with path skew), instead of once the primary path is sent
+     */
+    inline bool skewedRelease(const Stream& stream) const
+    {
+        return options_.path_skew.count() && stream.dualPath();
+    }
+
+    /**
+     * Pacing mode: instead of sending back-to-back all the datagrams due in the 
+     * period, every datagram is sent at its (paced) send tick along the period 
+     * [now, now + period). The datagrams due at the same wake-up are sent together.
+     * 
+     * @param [out] prepare_time Accumulated time gathering the datagrams
+     * 
+     * @param [out] send_time Accumulated time sending the datagrams
+     * 
+     * @returns The number of syscalls used to send the datagrams
+     */
+    size_t sendPacedBurst(const Clock::time_point& now, Burst& burst, Clock::duration& prepare_time, Clock::duration& send_time)
+    {
+        auto period_end = now + timer_.period();
+        size_t syscalls = 0;
+        Burst slice;
+
+        prepare_time = Clock::duration(0);
+        send_time = Clock::duration(0);
+
+        while(!exit_threads_) {
+            auto t_start = Clock::now();
+
+            slice.clear();
+            getSendBurst(t_start, slice);
+            auto t_prepare = Clock::now();
+
+            if(slice.count || slice.skewed) {
+                syscalls += sendBurst(slice);
+                burst.count += slice.count;
+                burst.size += slice.size;
+            }
+            auto t_send = Clock::now();
+
+            prepare_time += t_prepare - t_start;
+            send_time += t_send - t_prepare;
+
+            // Wait for the next datagram if it's due in this period
+            auto next_tick = Clock::time_point::max();
+
+            if(prepared_ring_.readAvailable())
+                next_tick = pacedTick(prepared_ring_.peek(0).send_tick);
+            if(!skewed_.empty())
+                next_tick = std::min(next_tick, skewed_.front().send_tick);
+
+            if(next_tick >= period_end)
+                break;
+
+            waitUntil(next_tick);
+        }
+
+        return syscalls;
+    }
+
+    /** 
+     * @returns The send tick delayed, if needed, to comply with the aggregated peak rate 
+     */
+    inline Clock::time_point pacedTick(const Clock::time_point& send_tick) const
+    {
+        return (options_.peak_rate && send_tick < next_aggregate_tick_) ? next_aggregate_tick_ : send_tick;
+    }
+
+    /** Accounts a datagram sent at paced_tick for the aggregated peak rate */
+    inline void commitPacedTick(const Clock::time_point& paced_tick, size_t size)
+    {
+        if(options_.peak_rate)
+            next_aggregate_tick_ = paced_tick + transmissionTime(size, options_.peak_rate);
+    }
+
+    /** @returns The time it takes to transmit size bytes at bitrate */
+    static inline Clock::duration transmissionTime(size_t size, uint64_t bitrate)
+    {
+        return std::chrono::duration_cast<Clock::duration>(std::chrono::nanoseconds(size * 8 * 1000000000ULL / bitrate));
+    }
+
+    /** Waits until a time point, sleeping most of the time and spinning the last microseconds */
+    void waitUntil(const Clock::time_point& t)
+    {
+        const auto SPIN = std::chrono::microseconds(50);
+
+        if(t - Clock::now() > SPIN)
+            std::this_thread::sleep_until(t - SPIN);
+
+        while(Clock::now() < t);
+    }
+
     /** 
-     * Build the burst with the datagrams that already expired
-     * @todo Work in the multiplexing algorithm to improve efficiency
+     * Build the burst with the datagrams that already expired.
+     * The streams are kept in a min-heap by the send tick of their front datagram, so
+     * the datagrams are added in strict deadline order and only the streams with 
+     * something due are touched. Streams with nothing to schedule are kept apart
+     * and polled until they have a datagram ready.
      */
     void prepareBurst(const Clock::time_point& now)
     {
 		std::lock_guard<std::mutex> lock(mutex_streams_);
 
-        bool datagrams_added = false;
+        Clock::time_point tick;
 
-        do
-        {
-            datagrams_added = false;
-
-            // Check front packet of every stream, if send_tick < now  then (is elegible) move it to burst
-            for(auto& stream : streams_) {
-				struct Burst::Element burst_element;
-                if(auto datagram = stream->popFrontDatagramElegible(now)) {
-					burst_element.datagram = datagram;
-					burst_element.endpoint = datagram->endpoint();
-					
-					// Add the datagram to the prepared_burst
-
-					while (prepared_burst_spin.test_and_set(std::memory_order_acquire)) // acquire lock
-						std::this_thread::yield();  
-					
-					prepared_burst_.elements.push_back(burst_element);
-					prepared_burst_spin.clear(std::memory_order_release); // release lock
-
-					datagrams_added = true;
-                }
+        // Move to the schedule the idle streams that have a datagram ready
+        for(size_t i = 0; i < idle_streams_.size(); ) {
+            auto stream = idle_streams_[i];
+            if(stream->frontSendTick(now, tick)) {
+                schedule_.push_back({tick, stream});
+                std::push_heap(schedule_.begin(), schedule_.end());
+                idle_streams_[i] = idle_streams_.back();
+                idle_streams_.pop_back();
             }
+            else
+                i++;
+        }
 
-        }while(datagrams_added);
+        // Pop the datagrams in deadline order while send_tick < now, and there's room for them
+        while(!schedule_.empty() && schedule_.front().tick < now && prepared_ring_.writeAvailable()) {
+
+            std::pop_heap(schedule_.begin(), schedule_.end());
+            auto entry = schedule_.back();
+            schedule_.pop_back();
+
+            auto keep = entry.stream->applyLatePolicy(entry.tick, now - send_buffering_preroll_);
+            auto datagram = entry.stream->popFrontDatagram(entry.tick);
+
+            // The dropped datagrams go through the ring too, the sender thread releases them in order
+            PreparedDatagram prepared;
+            prepared.data = datagram.data;
+            prepared.size = datagram.size;
+            prepared.sequence = datagram.sequence;
+            prepared.send_tick = datagram.send_tick;
+            prepared.endpoint = datagram.endpoint;
+            prepared.connection = entry.stream->connection(datagram);
+            prepared.stream = entry.stream;
+            prepared.dual_path = entry.stream->dualPath(datagram);
+            prepared.dropped = !keep;
+
+            prepared_ring_.push(prepared);
+
+            // Reschedule the stream with its next datagram
+            if(entry.stream->frontSendTick(now, tick)) {
+                schedule_.push_back({tick, entry.stream});
+                std::push_heap(schedule_.begin(), schedule_.end());
+            }
+            else
+                idle_streams_.push_back(entry.stream);
+        }
     }
 
-    /** Sends a group of datagrams to their endpoints */
-    void sendBurst(Burst& burst)
+    /** 
+     * Sends a group of datagrams to their endpoints 
+     * @returns The number of syscalls used to send the burst
+     */
+    size_t sendBurst(Burst& burst)
     {
-        auto num_datagrams = burst.elements.size();
+        auto syscalls = sender_->flush();
 
-        for(size_t i=0; i<num_datagrams; i++) {
-			const auto& element = burst.elements[i];
-            sender_.send(element.endpoint,
-                boost::asio::buffer((const void*)element.datagram->payload()->data(),
-				element.datagram->payload()->size()));
+        // The datagrams have been sent so their blocks can be released
+        for(size_t i = 0; i < burst.count; i++) {
+            auto& element = prepared_ring_.peek(i);
+            if(!skewedRelease(*element.stream))
+                element.stream->release();
         }
+        prepared_ring_.consume(burst.count);
+
+        for(size_t i = 0; i < burst.skewed; i++)
+            skewed_[i].stream->release();
+        skewed_.erase(skewed_.begin(), skewed_.begin() + burst.skewed);
+
+        auto occupancy = sender_->ringOccupancy();
+        if(occupancy > send_stats_.max_ring_occupancy)
+            send_stats_.max_ring_occupancy.store(occupancy, std::memory_order_relaxed);
+
+        send_stats_.send_failures.store(sender_->sendFailures(), std::memory_order_relaxed);
+
+        // Asynchronous backends
+        float submit_ms = sender_->submitLatency().count() / 1000000.0f;
+        float complete_ms = sender_->completeLatency().count() / 1000000.0f;
+
+        if(complete_ms > 0) {
+            if(submit_ms > send_stats_.max_submit_ms)
+                send_stats_.max_submit_ms.store(submit_ms, std::memory_order_relaxed);
+
+            if(submit_ms < send_stats_.min_submit_ms)
+                send_stats_.min_submit_ms.store(submit_ms, std::memory_order_relaxed);
+
+            if(complete_ms > send_stats_.max_complete_ms)
+                send_stats_.max_complete_ms.store(complete_ms, std::memory_order_relaxed);
+
+            if(complete_ms < send_stats_.min_complete_ms)
+                send_stats_.min_complete_ms.store(complete_ms, std::memory_order_relaxed);
+        }
+
+        return syscalls;
     }
 
     /** Stores send timming statistics */
@@ -601,6 +1727,7 @@ private:
                         const Clock::time_point& t_last_burst,
                         const Clock::time_point& t_prepare,
                         const Clock::time_point& t_send,
+                        size_t syscalls,
                         const Burst& burst)
     {
         // Avoid first call because t_last_burst is not initialized
@@ -635,7 +1762,13 @@ private:
         if(send_time_ms < send_stats_.min_send_ms)
             send_stats_.min_send_ms.store(send_time_ms, std::memory_order_relaxed);
 
-        if(std::chrono::milliseconds((uint32_t)timer_delta_ms) >= timer_.period() + std::chrono::milliseconds(2)) {
+        if(syscalls > send_stats_.max_syscalls)
+            send_stats_.max_syscalls.store(static_cast<uint32_t>(syscalls), std::memory_order_relaxed);
+
+        if(syscalls < send_stats_.min_syscalls)
+            send_stats_.min_syscalls.store(static_cast<uint32_t>(syscalls), std::memory_order_relaxed);
+
+        if(std::chrono::microseconds((uint32_t)(timer_delta_ms * 1000)) >= timer_.period() + std::chrono::milliseconds(2)) {
             send_stats_.high_burst_count_.fetch_add(1, std::memory_order_relaxed);
             Logger::get().debug(1) << logclass(DatagramsMuxer) << "High burst period! - " << burstTrace(timer_delta_ms, prepare_time_ms, send_time_ms) << std::endl;
         }
@@ -682,7 +1815,15 @@ private:
         std::atomic<float> min_prepare_ms;
         std::atomic<float> max_send_ms;
         std::atomic<float> min_send_ms;
+        std::atomic<uint32_t> max_syscalls;
+        std::atomic<uint32_t> min_syscalls;
         std::atomic<uint32_t> high_burst_count_;
+        std::atomic<float> max_ring_occupancy;
+        std::atomic<uint64_t> send_failures;
+        std::atomic<float> min_submit_ms;
+        std::atomic<float> max_submit_ms;
+        std::atomic<float> min_complete_ms;
+        std::atomic<float> max_complete_ms;
     } send_stats_;
 
 }; // DatagramsMuxer
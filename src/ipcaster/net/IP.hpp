@@ -23,4 +23,5 @@ namespace ip
 {
     using udp = boost::asio::ip::udp;
     using address = boost::asio::ip::address;
+    using address_v4 = boost::asio::ip::address_v4;
 }
\ No newline at end of file
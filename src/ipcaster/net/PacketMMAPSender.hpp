@@ -0,0 +1,250 @@
+//
+// Copyright (C) 2019 Adofo Martinez <adolfo at ipcaster dot net>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#pragma once
+
+#include <string>
+#include <cstring>
+
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/mman.h>
+#include <arpa/inet.h>
+#include <linux/if_packet.h>
+#include <linux/if_ether.h>
+#endif
+
+#include "ipcaster/base/Exception.hpp"
+#include "ipcaster/net/IP.hpp"
+#include "ipcaster/net/BurstSender.hpp"
+#include "ipcaster/net/UDPFrameBuilder.hpp"
+
+namespace ipcaster
+{
+
+/**
+ * Raw sender backend based on a PACKET_MMAP (TPACKET_V2) TX ring.
+ *
+ * The complete Ethernet / IPv4 / UDP frames (see UDPFrameBuilder) are 
+ * written straight into a ring shared with the kernel. The whole burst 
+ * is handed to the kernel with one send() call, bypassing the UDP / IP stack.
+ *
+ * Requires CAP_NET_RAW. Linux only.
+ */
+class PacketMMAPSender : public BurstSender
+{
+public:
+
+    // Size of a ring frame, holds the tpacket header and a full ethernet frame
+    static constexpr size_t FRAME_SIZE = 2048;
+
+    // Ring block size (a multiple of the page size)
+    static constexpr size_t BLOCK_SIZE = 1 << 16;
+
+    // Default number of frames of the ring
+    static constexpr size_t DEFAULT_FRAME_COUNT = 8192;
+
+    /** Constructor
+     *
+     * @param interface Name of the output network interface
+     *
+     * @param frame_count Number of frames of the TX ring
+     *
+     * @throws std::exception Thrown on failure (no permissions, unknown interface, ...)
+     */
+    PacketMMAPSender(const std::string& interface, size_t frame_count = DEFAULT_FRAME_COUNT)
+    : frame_builder_(interface)
+    {
+#ifdef __linux__
+        fd_ = socket(AF_PACKET, SOCK_RAW, 0);
+        if(fd_ < 0)
+            throw Exception(fndbg(PacketMMAPSender) + "can't open packet socket: " + strerror(errno));
+
+        try {
+            setup(frame_count);
+        }
+        catch(...) {
+            release();
+            throw;
+        }
+#else
+        throw Exception(fndbg(PacketMMAPSender) + "PACKET_MMAP is only supported on Linux");
+#endif
+    }
+
+    ~PacketMMAPSender()
+    {
+#ifdef __linux__
+        release();
+#endif
+    }
+
+    PacketMMAPSender(const PacketMMAPSender&) = delete;
+    PacketMMAPSender& operator=(const PacketMMAPSender&) = delete;
+
+    /** Resolves the MAC of the destination, see UDPFrameBuilder::addDestination() */
+    void addDestination(const ip::address& address) override
+    {
+        frame_builder_.addDestination(address);
+    }
+
+    /**
+     * Writes the frame of a datagram in the next free slot of the ring.
+     * If the ring is full or the datagram doesn't fit in a frame, the
+     * datagram is dropped and accounted as a failure.
+     */
+    void push(const ip::udp::endpoint& endpoint, const void* data, size_t size, uint64_t /*txtime*/ = 0, int /*socket*/ = -1) override
+    {
+#ifdef __linux__
+        auto hdr = frame(next_frame_);
+
+        // The kernel marks the frames it couldn't send, they're free again
+        if(hdr->tp_status == TP_STATUS_WRONG_FORMAT) {
+            send_failures_++;
+            hdr->tp_status = TP_STATUS_AVAILABLE;
+        }
+
+        if(hdr->tp_status != TP_STATUS_AVAILABLE) {
+            send_failures_++;
+            return;
+        }
+
+        auto packet = reinterpret_cast<uint8_t*>(hdr) + FRAME_DATA_OFFSET;
+        auto frame_size = frame_builder_.build(packet, FRAME_SIZE - FRAME_DATA_OFFSET, endpoint, data, size);
+
+        if(!frame_size) {
+            send_failures_++;
+            return;
+        }
+
+        hdr->tp_len = static_cast<uint32_t>(frame_size);
+        hdr->tp_status = TP_STATUS_SEND_REQUEST;
+
+        next_frame_ = (next_frame_ + 1) % frame_count_;
+        pending_++;
+#endif
+    }
+
+    /**
+     * Hands the frames written since the last flush to the kernel and
+     * waits until they have been sent
+     *
+     * @returns The number of system calls used (1 or 0 if nothing to send)
+     */
+    size_t flush() override
+    {
+        if(!pending_)
+            return 0;
+
+        ring_occupancy_ = static_cast<float>(pending_) / frame_count_;
+
+#ifdef __linux__
+        if(send(fd_, nullptr, 0, 0) < 0)
+            send_failures_ += pending_;
+#endif
+        pending_ = 0;
+
+        return 1;
+    }
+
+    float ringOccupancy() const override { return ring_occupancy_; }
+
+    uint64_t sendFailures() const override { return send_failures_; }
+
+private:
+
+    // Builds the frames of the datagrams
+    UDPFrameBuilder frame_builder_;
+
+    // Packet socket
+    int fd_ = -1;
+
+    // Mapped TX ring
+    void* ring_ = nullptr;
+    size_t ring_size_ = 0;
+    size_t frame_count_ = 0;
+
+    // Next ring frame to be written
+    size_t next_frame_ = 0;
+
+    // Frames written since the last flush
+    size_t pending_ = 0;
+
+    // Fraction of the ring used by the last flush
+    float ring_occupancy_ = 0;
+
+    // Datagrams dropped or rejected by the kernel
+    uint64_t send_failures_ = 0;
+
+#ifdef __linux__
+    // Offset of the packet inside a ring frame
+    static constexpr size_t FRAME_DATA_OFFSET = TPACKET_ALIGN(sizeof(struct tpacket2_hdr));
+
+    /** Unmaps the ring and closes the socket */
+    void release()
+    {
+        if(ring_)
+            munmap(ring_, ring_size_);
+        ring_ = nullptr;
+
+        close(fd_);
+    }
+
+    /** @returns The header of a ring frame */
+    inline struct tpacket2_hdr* frame(size_t index)
+    {
+        return reinterpret_cast<struct tpacket2_hdr*>(static_cast<uint8_t*>(ring_) + index * FRAME_SIZE);
+    }
+
+    /** Sets up the TX ring and binds the socket to the interface */
+    void setup(size_t frame_count)
+    {
+        int version = TPACKET_V2;
+        if(setsockopt(fd_, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) < 0)
+            throw Exception(fndbg(PacketMMAPSender) + "TPACKET_V2 not supported: " + strerror(errno));
+
+        struct tpacket_req req;
+        memset(&req, 0, sizeof(req));
+        req.tp_frame_size = FRAME_SIZE;
+        req.tp_block_size = BLOCK_SIZE;
+        req.tp_block_nr = static_cast<unsigned int>((frame_count * FRAME_SIZE + BLOCK_SIZE - 1) / BLOCK_SIZE);
+        req.tp_frame_nr = req.tp_block_nr * (BLOCK_SIZE / FRAME_SIZE);
+
+        if(setsockopt(fd_, SOL_PACKET, PACKET_TX_RING, &req, sizeof(req)) < 0)
+            throw Exception(fndbg(PacketMMAPSender) + "can't create the TX ring: " + strerror(errno));
+
+        frame_count_ = req.tp_frame_nr;
+        ring_size_ = static_cast<size_t>(req.tp_block_nr) * req.tp_block_size;
+        auto ring = mmap(nullptr, ring_size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+        if(ring == MAP_FAILED)
+            throw Exception(fndbg(PacketMMAPSender) + "can't map the TX ring: " + strerror(errno));
+        ring_ = ring;
+
+        struct sockaddr_ll addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sll_family = AF_PACKET;
+        addr.sll_protocol = htons(ETH_P_IP);
+        addr.sll_ifindex = frame_builder_.ifindex();
+
+        if(bind(fd_, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) < 0)
+            throw Exception(fndbg(PacketMMAPSender) + "can't bind the packet socket: " + strerror(errno));
+    }
+
+#endif
+};
+
+}
@@ -0,0 +1,122 @@
+//
+// Copyright (C) 2019 Adofo Martinez <adolfo at ipcaster dot net>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+namespace ipcaster
+{
+
+/**
+ * Setup of the egress side (how datagrams are sent) of the DatagramsMuxer.
+ * The defaults reproduce the plain timer driven burst sending.
+ */
+struct SenderOptions
+{
+    /** Egress backends */
+    enum class Backend
+    {
+        UDP_SOCKET,     // Regular UDP socket (sendmmsg)
+        IO_URING,       // Regular UDP socket, asynchronous sends through io_uring (UringSender)
+        PACKET_MMAP,    // Raw frames written to an AF_PACKET TX ring (PacketMMAPSender)
+        XDP_SOCKET      // Raw frames submitted to an AF_XDP socket TX ring (XDPSender)
+    };
+
+    // Backend used to send the datagrams
+    Backend backend = Backend::UDP_SOCKET;
+
+    /** What to do with the datagrams already late when they are prepared */
+    enum class LatePolicy
+    {
+        CATCH_UP,   // Send them, at most at catchup_overspeed times the stream bitrate
+        DROP,       // Drop the ones later than late_threshold
+        RESYNC      // Shift the stream time base by the lateness of the ones later than late_threshold
+    };
+
+    // Output network interface, required by the PACKET_MMAP and XDP_SOCKET backends
+    std::string interface;
+
+    // Interface queue the AF_XDP socket is bound to, every shard uses the next one
+    uint32_t xdp_queue = 0;
+
+    // Kernel scheduled transmission: every datagram carries its send tick
+    // (SO_TXTIME) and the fq / etf qdisc releases it at that time. Linux UDP_SOCKET backend only.
+    bool txtime = false;
+
+    // How far ahead of its send tick a datagram is handed to the kernel in txtime mode,
+    // 0 means twice the burst period
+    std::chrono::microseconds txtime_lookahead = std::chrono::microseconds(0);
+
+    // Runs of same size datagrams to the same destination are sent as one UDP GSO
+    // (UDP_SEGMENT) message, segmented by the kernel / NIC. Linux UDP_SOCKET backend only, ignored with txtime
+    bool gso = false;
+
+    // Intra-burst pacing: instead of sending every datagram due in the period back-to-back,
+    // the sender thread releases them across the period at their own send ticks
+    bool pacing = false;
+
+    // Max aggregated output rate in bits per second, 0 = unlimited. Without pacing
+    // or txtime it only bounds the amount of data sent per burst period. With several 
+    // shards (ShardedDatagramsMuxer) it's divided evenly among them
+    uint64_t peak_rate = 0;
+
+    // Max output rate of every stream in bits per second, 0 = unlimited
+    uint64_t stream_peak_rate = 0;
+
+    // Send through a connected UDP socket per destination: no route lookup per datagram, and
+    // the errors of a destination (e.g. ICMP unreachable) are accounted to it.
+    // UDP_SOCKET and IO_URING backends only, ignored with txtime
+    bool connect = false;
+
+    // Send with MSG_ZEROCOPY, the kernel transmits from the payload buffers instead of copying 
+    // them, the buffers are kept alive until the kernel releases them. Pays off with large 
+    // (GSO) messages. Linux UDP_SOCKET backend only, not applied to the connected sockets
+    bool zerocopy = false;
+
+    // Drift control: when the datagrams of a stream are persistently popped later than their
+    // send ticks (wakeup lateness, a source slower than real time...), the stream time mapping
+    // is slewed to absorb it, at most this many ppm of the elapsed time. 0 = disabled
+    uint32_t max_drift_ppm = 0;
+
+    // Late datagrams policy
+    LatePolicy late_policy = LatePolicy::CATCH_UP;
+
+    // DROP and RESYNC policies, lateness that triggers them
+    std::chrono::milliseconds late_threshold = std::chrono::milliseconds(100);
+
+    // CATCH_UP policy, max rate of the late datagrams relative to the stream bitrate 
+    // (e.g. 1.2 = 20% overspeed, at least 1), 0 = unbounded (all sent in the next burst)
+    double catchup_overspeed = 0;
+
+    // Rewrite the PCRs of the TS packets with the actual departure time of their datagrams
+    // (see PCRRestamper), so the scheduling granularity isn't seen as PCR jitter downstream
+    bool pcr_restamp = false;
+
+    // SMPTE 2022-1 FEC matrix of every stream, L columns x D rows, sent to the stream 
+    // port + 2 (column FEC) and port + 4 (row FEC). The media datagrams are RTP 
+    // encapsulated. 0 disables it
+    unsigned int fec_columns = 0;
+    unsigned int fec_rows = 0;
+
+    // SMPTE 2022-7 streams (with a secondary destination), delay of the secondary 
+    // path datagrams relative to the primary ones
+    std::chrono::microseconds path_skew = std::chrono::microseconds(0);
+};
+
+}
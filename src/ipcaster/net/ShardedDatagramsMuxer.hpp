@@ -0,0 +1,276 @@
+//
+// Copyright (C) 2019 Adofo Martinez <adolfo at ipcaster dot net>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#pragma once
+
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "ipcaster/base/Exception.hpp"
+#include "ipcaster/net/DatagramsMuxer.hpp"
+
+namespace ipcaster
+{
+
+/**
+ * Spreads the streams among several DatagramsMuxer (shards), every shard
+ * runs its own prepare / sender threads pair, optionally pinned to a CPU,
+ * so the aggregated egress is not limited to what one core can push.
+ *
+ * The streams are assigned to the shards when created, following a
+ * balancing policy.
+ */
+template <class Timer>
+class ShardedDatagramsMuxer
+{
+    using Clock = std::chrono::high_resolution_clock;
+
+public:
+
+    using Shard = DatagramsMuxer<Timer>;
+    using Stream = typename Shard::Stream;
+
+    /** Policies to choose the shard of a new stream */
+    enum class Policy
+    {
+        LEAST_STREAMS,  // The shard with less streams
+        LEAST_BITRATE   // The shard with less (estimated) aggregated bitrate
+    };
+
+    /** Constructor
+     *
+     * @param num_shards Number of shards (prepare / sender threads pairs)
+     *
+     * @param cpus CPU to pin every shard to, shard i is pinned to cpus[i % cpus.size()].
+     * If empty the threads are not pinned.
+     *
+     * @param policy Balancing policy
+     *
+     * @param burst_period The period between bursts of every shard
+     *
+     * @param options Egress setup of every shard, the aggregated peak rate is divided among them
+     *
+     * @throws std::exception
+     */
+    ShardedDatagramsMuxer(size_t num_shards = 1, const std::vector<int>& cpus = std::vector<int>(), Policy policy = Policy::LEAST_BITRATE,
+        std::chrono::microseconds burst_period = std::chrono::milliseconds(4), const SenderOptions& options = SenderOptions())
+    {
+        configure(num_shards, cpus, policy, burst_period, options);
+    }
+
+    /**
+     * Recreates the shards with a new setup
+     *
+     * @param num_shards Number of shards (prepare / sender threads pairs)
+     *
+     * @param cpus CPU to pin every shard to, shard i is pinned to cpus[i % cpus.size()].
+     * If empty the threads are not pinned.
+     *
+     * @param policy Balancing policy
+     *
+     * @param burst_period The period between bursts of every shard
+     *
+     * @param options Egress setup of every shard, the aggregated peak rate is divided among them
+     *
+     * @pre No stream has been created yet
+     *
+     * @throws std::exception
+     */
+    void configure(size_t num_shards, const std::vector<int>& cpus = std::vector<int>(), Policy policy = Policy::LEAST_BITRATE,
+        std::chrono::microseconds burst_period = std::chrono::milliseconds(4), const SenderOptions& options = SenderOptions())
+    {
+        std::lock_guard<std::mutex> lock(mutex_shards_);
+
+        for(auto& shard : shards_) {
+            if(shard->getStreams().size())
+                throw Exception(fndbg(ShardedDatagramsMuxer) + "can't be reconfigured with streams running");
+        }
+
+        // Built apart so the current shards are kept if the new setup fails
+        std::vector<std::unique_ptr<Shard>> shards;
+
+        num_shards = std::max(num_shards, static_cast<size_t>(1));
+
+        for(size_t i = 0; i < num_shards; i++) {
+            int cpu = cpus.empty() ? -1 : cpus[i % cpus.size()];
+
+            // Every shard owns an interface queue (AF_XDP)
+            auto shard_options = options;
+            shard_options.xdp_queue = options.xdp_queue + static_cast<uint32_t>(i);
+
+            // Every shard paces its own output, they share the aggregated peak rate (the first 
+            // ones get the remainder, and none is left unlimited)
+            if(options.peak_rate)
+                shard_options.peak_rate = std::max(static_cast<uint64_t>(1), options.peak_rate / num_shards + (i < options.peak_rate % num_shards ? 1 : 0));
+
+            shards.push_back(std::make_unique<Shard>(burst_period, std::chrono::milliseconds(40), cpu, shard_options));
+        }
+
+        shards_ = std::move(shards);
+
+        policy_ = policy;
+    }
+
+    /**
+     * Creates a new stream in the less loaded shard
+     *
+     * @param target_ip Destination IP for all the datagrams pushed to the stream
+     *
+     * @param target_port Destination port for all the datagrams pushed to the stream
+     *
+     * @param secondary_ip SMPTE 2022-7 secondary destination IP, empty for a single path stream
+     *
+     * @param secondary_port SMPTE 2022-7 secondary destination port
+     *
+     * @returns A reference to the new stream
+     */
+    std::shared_ptr<Stream> createStream(const std::string& target_ip, uint16_t target_port, 
+        const std::string& secondary_ip = std::string(), uint16_t secondary_port = 0)
+    {
+        std::lock_guard<std::mutex> lock(mutex_shards_);
+
+        Shard* selected = nullptr;
+        uint64_t selected_load = std::numeric_limits<uint64_t>::max();
+
+        for(auto& shard : shards_) {
+            auto load = shardLoad(*shard);
+            if(load < selected_load) {
+                selected = shard.get();
+                selected_load = load;
+            }
+        }
+
+        return selected->createStream(target_ip, target_port, secondary_ip, secondary_port);
+    }
+
+    /** @returns A vector of references to the streams of all the shards */
+    std::vector<std::shared_ptr<Stream>> getStreams()
+    {
+        std::lock_guard<std::mutex> lock(mutex_shards_);
+
+        std::vector<std::shared_ptr<Stream>> streams;
+
+        for(auto& shard : shards_) {
+            auto shard_streams = shard->getStreams();
+            streams.insert(streams.end(), shard_streams.begin(), shard_streams.end());
+        }
+
+        return streams;
+    }
+
+    /** @returns The number of shards */
+    size_t numShards()
+    {
+        std::lock_guard<std::mutex> lock(mutex_shards_);
+
+        return shards_.size();
+    }
+
+    /**
+     * @param index Shard index
+     * @returns A reference to a shard, to query its own statistics
+     * @pre index < numShards()
+     */
+    Shard& shard(size_t index)
+    {
+        std::lock_guard<std::mutex> lock(mutex_shards_);
+
+        return *shards_[index];
+    }
+
+    /** @returns The sending statistics aggregated for all the shards */
+    typename Shard::SendStats getSendStats()
+    {
+        std::lock_guard<std::mutex> lock(mutex_shards_);
+
+        typename Shard::SendStats stats;
+        stats.valid = false;
+
+        for(auto& shard : shards_)
+            stats.merge(shard->getSendStats());
+
+        return stats;
+    }
+
+    /** @returns A string with the aggregated sending statistics followed by every shard ones */
+    std::string stats()
+    {
+        auto str = getSendStats().str();
+
+        std::lock_guard<std::mutex> lock(mutex_shards_);
+
+        if(shards_.size() > 1) {
+            for(size_t i = 0; i < shards_.size(); i++) {
+                Clock::duration max_burst;
+                auto bandwidth = shards_[i]->getOutputBandwidth(max_burst);
+                char shard_str[128];
+                snprintf(shard_str, sizeof(shard_str), " | shard%zu %zu streams %.3fMbps ", i, shards_[i]->getStreams().size(), bandwidth / 1000000.0);
+                str += shard_str + shards_[i]->stats();
+            }
+        }
+
+        return str;
+    }
+
+    /**
+     * @param [out] max_burst Maximum recent burst duration of all the shards
+     * @returns The current output bandwidth of all the shards
+     */
+    uint64_t getOutputBandwidth(Clock::duration& max_burst)
+    {
+        std::lock_guard<std::mutex> lock(mutex_shards_);
+
+        uint64_t bitrate = 0;
+        max_burst = Clock::duration(0);
+
+        for(auto& shard : shards_) {
+            Clock::duration shard_max_burst;
+            bitrate += shard->getOutputBandwidth(shard_max_burst);
+            max_burst = std::max(max_burst, shard_max_burst);
+        }
+
+        return bitrate;
+    }
+
+private:
+
+    // The DatagramsMuxer of every shard
+    std::vector<std::unique_ptr<Shard>> shards_;
+
+    // Mutex for the shards_ vector
+    std::mutex mutex_shards_;
+
+    // Balancing policy
+    Policy policy_;
+
+    /** @returns The load of a shard according to the balancing policy */
+    uint64_t shardLoad(Shard& shard)
+    {
+        auto streams = shard.getStreams();
+
+        if(policy_ == Policy::LEAST_STREAMS)
+            return streams.size();
+
+        uint64_t bitrate = 0;
+        for(auto& stream : streams)
+            bitrate += stream->estimatedBitrate();
+
+        return bitrate;
+    }
+};
+
+}
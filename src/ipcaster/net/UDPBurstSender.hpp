@@ -0,0 +1,588 @@
+//
+// Copyright (C) 2019 Adofo Martinez <adolfo at ipcaster dot net>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#pragma once
+
+#include <deque>
+#include <memory>
+#include <vector>
+#include <cstring>
+#include <algorithm>
+
+#ifdef __linux__
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#include <linux/net_tstamp.h>
+#include <linux/errqueue.h>
+#include <time.h>
+#endif
+
+#include "ipcaster/base/Logger.hpp"
+#include "ipcaster/net/IP.hpp"
+#include "ipcaster/net/UDPSender.hpp"
+#include "ipcaster/net/BurstSender.hpp"
+
+namespace ipcaster
+{
+
+/**
+ * Sends a burst of datagrams with the minimum number of system calls.
+ *
+ * The datagrams are queued with push() and sent with flush(). On Linux
+ * the whole burst is sent with sendmmsg(), the mmsghdr / iovec arrays
+ * are kept between bursts so no allocation is done in steady state.
+ * If sendmmsg() fails or sends only a part of the burst, the remaining
+ * datagrams are sent one by one.
+ * On other platforms every datagram is sent with UDPSender::send().
+ *
+ * Optionally (Linux only) every datagram can carry its transmission time 
+ * (SO_TXTIME) so the fq / etf qdisc releases it at that time.
+ *
+ * The datagrams can be sent through sockets connected to their endpoints,
+ * every socket gets its own sendmmsg() call. An endpoint error reported
+ * in a connected socket (e.g. ICMP port unreachable) is accounted as a 
+ * send failure instead of thrown.
+ *
+ * Also optionally (Linux only), runs of same size datagrams to the same 
+ * endpoint are sent as a single UDP GSO (UDP_SEGMENT) message, the kernel 
+ * splits it in the original datagrams, so the stack is traversed once per run.
+ *
+ * Also optionally (Linux only), the datagrams are sent with MSG_ZEROCOPY: the
+ * kernel transmits from the payload buffers instead of copying them, so they
+ * are pinned (see pin()) until the completion notifications are read from 
+ * the socket error queue. Only the sends through the sender socket (not the 
+ * connected ones) are zerocopy. It pays off with large messages (GSO).
+ */
+class UDPBurstSender : public BurstSender
+{
+public:
+
+    // Max number of messages passed to a single sendmmsg() call (UIO_MAXIOV)
+    static constexpr size_t MAX_MESSAGES_PER_CALL = 1024;
+
+    // Max number of datagrams merged in a GSO message (kernel UDP_MAX_SEGMENTS)
+    static constexpr size_t GSO_MAX_SEGMENTS = 64;
+
+    // Max payload of a GSO message (has to fit in an IP packet)
+    static constexpr size_t GSO_MAX_BYTES = 65000;
+
+    UDPBurstSender()
+        :   txtime_enabled_(false),
+            gso_enabled_(false)
+    {
+    }
+
+    /** Destructor
+     * Waits a bit for the zerocopy sends in flight, so their buffers aren't
+     * released while the kernel is still transmitting them
+     */
+    ~UDPBurstSender()
+    {
+#ifdef __linux__
+        for(int i = 0; i < ZEROCOPY_DRAIN_POLLS && !pinned_messages_.empty(); i++) {
+            struct pollfd pfd = { sender_.nativeHandle(), 0, 0 };
+            poll(&pfd, 1, 1);
+            reapZeroCopy();
+        }
+#endif
+    }
+    /**
+     * Enables the kernel scheduled transmission (SO_TXTIME) of the datagrams.
+     * The transmission times are CLOCK_MONOTONIC nanoseconds, as required by 
+     * the fq qdisc.
+     *
+     * @returns false if not supported by the platform / kernel
+     */
+    bool enableTxTime()
+    {
+#if defined(__linux__) && defined(SO_TXTIME)
+        struct sock_txtime config;
+        config.clockid = CLOCK_MONOTONIC;
+        config.flags = 0;
+
+        txtime_enabled_ = setsockopt(sender_.nativeHandle(), SOL_SOCKET, SO_TXTIME, &config, sizeof(config)) == 0;
+#endif
+        return txtime_enabled_;
+    }
+
+    /** @returns true if the kernel scheduled transmission is enabled */
+    bool txTimeEnabled() const override { return txtime_enabled_; }
+
+    /**
+     * Enables the UDP GSO (UDP_SEGMENT) send of same destination runs.
+     * If the kernel / NIC later rejects a GSO message, GSO is disabled 
+     * and the datagrams are sent one by one.
+     * GSO is not applied while the kernel scheduled transmission is enabled,
+     * as all the datagrams of a GSO message would share the same txtime.
+     *
+     * @returns false if not supported by the platform / kernel
+     */
+    bool enableGSO()
+    {
+#if defined(__linux__) && defined(UDP_SEGMENT)
+        int segment_size = 0;
+        socklen_t len = sizeof(segment_size);
+
+        gso_enabled_ = getsockopt(sender_.nativeHandle(), SOL_UDP, UDP_SEGMENT, &segment_size, &len) == 0;
+#endif
+        return gso_enabled_;
+    }
+
+    /** @returns true if the UDP GSO send is enabled */
+    inline bool gsoEnabled() const { return gso_enabled_; }
+
+    /**
+     * Enables the MSG_ZEROCOPY send of the datagrams. From then on, the caller
+     * has to pin() the payload of every pushed datagram.
+     *
+     * @returns false if not supported by the platform / kernel (UDP needs Linux 5.0)
+     */
+    bool enableZeroCopy()
+    {
+#if defined(__linux__) && defined(SO_ZEROCOPY) && defined(MSG_ZEROCOPY)
+        int one = 1;
+
+        zerocopy_enabled_ = setsockopt(sender_.nativeHandle(), SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)) == 0;
+#endif
+        return zerocopy_enabled_;
+    }
+
+    bool zeroCopyEnabled() const override { return zerocopy_enabled_; }
+
+    /** Pins the payload of the last pushed datagram until its zerocopy send completes */
+    void pin(std::shared_ptr<const void> buffer) override
+    {
+        if(zerocopy_enabled_ && !datagrams_.empty())
+            datagrams_.back().buffer = std::move(buffer);
+    }
+
+    /** @returns The number of payloads pinned by zerocopy sends not completed yet */
+    inline size_t pinnedBuffers() const { return pinned_buffers_.size(); }
+
+    /**
+     * Queues a datagram to be sent in the next flush()
+     *
+     * @param endpoint Target ip and port
+     *
+     * @param data Pointer to the payload, must remain valid until flush() returns
+     *
+     * @param size Size of the payload in bytes
+     * 
+     * @param txtime Transmission time (CLOCK_MONOTONIC nanoseconds), only used if 
+     * enableTxTime() succeeded
+     * 
+     * @param socket Socket connected to the endpoint to send through, -1 to use 
+     * the sender one
+     */
+    void push(const ip::udp::endpoint& endpoint, const void* data, size_t size, uint64_t txtime = 0, int socket = -1) override
+    {
+        datagrams_.push_back({endpoint, data, size, txtime, datagrams_.size(), socket, nullptr});
+
+        if(socket >= 0)
+            connected_ = true;
+    }
+
+    uint64_t sendFailures() const override { return send_failures_; }
+
+    /**
+     * Sends all the queued datagrams
+     *
+     * @returns The number of system calls used to send the burst
+     *
+     * @throws UDPSender::SystemError Thrown on failure.
+     */
+    size_t flush() override
+    {
+        size_t syscalls = 0;
+        size_t sent = 0;
+
+#ifdef __linux__
+        // Release the buffers of the zerocopy sends already completed
+        if(!pinned_messages_.empty())
+            reapZeroCopy();
+
+        // Group the datagrams by endpoint (keeping their order) to get the longest GSO runs
+        // and one sendmmsg() per connected socket, the whole burst is sent at once so the 
+        // order between endpoints doesn't matter
+        if(gsoActive() || (connected_ && !txtime_enabled_)) {
+            std::sort(datagrams_.begin(), datagrams_.end(), [](const QueuedDatagram& a, const QueuedDatagram& b) {
+                return a.endpoint < b.endpoint || (a.endpoint == b.endpoint && a.order < b.order);
+            });
+        }
+
+        buildMessages();
+
+        size_t message = 0;
+
+        while(message < num_messages_) {
+            // Messages of the same socket
+            auto socket = messageSocket(message);
+            size_t count = 1;
+            while(message + count < num_messages_ && count < MAX_MESSAGES_PER_CALL && messageSocket(message + count) == socket)
+                count++;
+
+            auto ret = sendmmsg(socket, &messages_[message], static_cast<unsigned int>(count), zeroCopyFlag(socket));
+            syscalls++;
+
+            if(ret > 0) {
+                if(zeroCopyFlag(socket))
+                    pinMessages(message, static_cast<size_t>(ret));
+                message += ret;
+            }
+
+            // Partial send or error, fallback to per message send
+            if(ret != static_cast<int>(count))
+                break;
+        }
+
+        for(; message < num_messages_; message++) {
+            auto& hdr = messages_[message].msg_hdr;
+            syscalls++;
+
+            auto socket = messageSocket(message);
+            auto flags = zeroCopyFlag(socket);
+
+            if(sendmsg(socket, &hdr, flags) >= 0) {
+                if(flags)
+                    pinMessages(message, 1);
+                continue;
+            }
+
+            // Too many zerocopy notifications pending (optmem limit), send this one copying it
+            if(flags && errno == ENOBUFS) {
+                reapZeroCopy();
+                syscalls++;
+                if(sendmsg(socket, &hdr, 0) >= 0)
+                    continue;
+            }
+
+            // Error of the endpoint of a connected socket (ICMP unreachable...), only this destination fails
+            if(datagrams_[first_datagram_[message]].socket >= 0 && 
+                (errno == ECONNREFUSED || errno == EHOSTUNREACH || errno == ENETUNREACH)) {
+                send_failures_ += hdr.msg_iovlen;
+                continue;
+            }
+
+            // GSO message rejected (no kernel / NIC support), disable GSO and send the run one by one,
+            // through the socket it was queued on
+            if(hdr.msg_iovlen > 1 && (errno == EIO || errno == EINVAL || errno == EOPNOTSUPP)) {
+                gso_enabled_ = false;
+                for(size_t i = first_datagram_[message]; i < first_datagram_[message] + hdr.msg_iovlen; i++) {
+                    const auto& datagram = datagrams_[i];
+                    syscalls++;
+
+                    if(datagram.socket < 0)
+                        sender_.send(datagram.endpoint, boost::asio::buffer(datagram.data, datagram.size));
+                    else if(::send(datagram.socket, datagram.data, datagram.size, 0) < 0) {
+                        if(errno == ECONNREFUSED || errno == EHOSTUNREACH || errno == ENETUNREACH) {
+                            send_failures_++;
+                            continue;
+                        }
+
+                        datagrams_.clear();
+                        connected_ = false;
+                        throw UDPSender::SystemError(boost::system::error_code(errno, boost::system::system_category()));
+                    }
+                }
+                continue;
+            }
+
+            datagrams_.clear();
+            connected_ = false;
+            throw UDPSender::SystemError(boost::system::error_code(errno, boost::system::system_category()));
+        }
+
+        sent = datagrams_.size();
+#endif
+
+        for(; sent < datagrams_.size(); sent++) {
+            const auto& datagram = datagrams_[sent];
+            sender_.send(datagram.endpoint, boost::asio::buffer(datagram.data, datagram.size));
+            syscalls++;
+        }
+
+        datagrams_.clear();
+        connected_ = false;
+
+        return syscalls;
+    }
+
+    /** @returns The number of datagrams queued */
+    inline size_t size() const { return datagrams_.size(); }
+
+private:
+
+    // A queued datagram
+    struct QueuedDatagram
+    {
+        ip::udp::endpoint endpoint;
+        const void* data;
+        size_t size;
+        uint64_t txtime;
+        size_t order;
+        int socket;
+
+        // Payload owner, pinned while a zerocopy send uses it
+        std::shared_ptr<const void> buffer;
+    };
+
+    // Socket used to send
+    UDPSender sender_;
+
+    // Datagrams pending to be sent in the next flush()
+    std::vector<QueuedDatagram> datagrams_;
+
+    // SO_TXTIME enabled
+    bool txtime_enabled_;
+
+    // UDP GSO enabled
+    bool gso_enabled_;
+
+    // Some datagram of the burst is sent through a connected socket
+    bool connected_ = false;
+
+    // Datagrams that failed to be sent
+    uint64_t send_failures_ = 0;
+
+    // MSG_ZEROCOPY enabled
+    bool zerocopy_enabled_ = false;
+
+    // Polls (1 ms) waiting for the zerocopy completions at destruction
+    static constexpr int ZEROCOPY_DRAIN_POLLS = 100;
+
+    // Zerocopy messages sent and not released yet, in kernel notification id order. 
+    // Every message records if it has completed and how many buffers (GSO) it pins
+    struct PinnedMessage
+    {
+        bool completed;
+        size_t buffers;
+    };
+    std::deque<PinnedMessage> pinned_messages_;
+
+    // Buffers pinned by pinned_messages_, in the same order
+    std::deque<std::shared_ptr<const void>> pinned_buffers_;
+
+    // Kernel notification id of the front of pinned_messages_
+    uint32_t pinned_first_id_ = 0;
+
+    // The kernel notified it copied some zerocopy send (already logged)
+    bool zerocopy_copied_ = false;
+
+    /** @returns true if the same destination runs are merged in GSO messages */
+    inline bool gsoActive() const { return gso_enabled_ && !txtime_enabled_; }
+
+#ifdef __linux__
+    // sendmmsg() arrays, they only grow so they are reused between bursts
+    std::vector<struct mmsghdr> messages_;
+    std::vector<struct iovec> iovecs_;
+
+    // Number of messages built from the queued datagrams (GSO merges several datagrams in one)
+    size_t num_messages_ = 0;
+
+    // Index in datagrams_ of the first datagram of every message
+    std::vector<size_t> first_datagram_;
+
+    // Ancillary data buffers, one cmsg (SCM_TXTIME or UDP_SEGMENT) per message
+    static constexpr size_t CONTROL_SIZE = CMSG_SPACE(sizeof(uint64_t));
+    std::vector<uint8_t> controls_;
+
+    // Fills the sendmmsg() arrays from the queued datagrams
+    void buildMessages()
+    {
+        if(messages_.size() < datagrams_.size()) {
+            messages_.resize(datagrams_.size());
+            iovecs_.resize(datagrams_.size());
+            first_datagram_.resize(datagrams_.size());
+        }
+
+        if((txtime_enabled_ || gso_enabled_) && controls_.size() < datagrams_.size() * CONTROL_SIZE)
+            controls_.resize(datagrams_.size() * CONTROL_SIZE);
+
+        num_messages_ = 0;
+
+        for(size_t i = 0; i < datagrams_.size(); ) {
+            auto& datagram = datagrams_[i];
+            auto& hdr = messages_[num_messages_].msg_hdr;
+            auto run = gsoActive() ? gsoRunLength(i) : 1;
+
+            for(size_t j = i; j < i + run; j++) {
+                iovecs_[j].iov_base = const_cast<void*>(datagrams_[j].data);
+                iovecs_[j].iov_len = datagrams_[j].size;
+            }
+
+            // A connected socket already has the destination
+            hdr.msg_name = datagram.socket < 0 ? datagram.endpoint.data() : nullptr;
+            hdr.msg_namelen = datagram.socket < 0 ? static_cast<socklen_t>(datagram.endpoint.size()) : 0;
+            hdr.msg_iov = &iovecs_[i];
+            hdr.msg_iovlen = run;
+            hdr.msg_control = nullptr;
+            hdr.msg_controllen = 0;
+            hdr.msg_flags = 0;
+
+            if(run > 1)
+                setSegmentSize(hdr, &controls_[num_messages_ * CONTROL_SIZE], datagram.size);
+            else if(txtime_enabled_)
+                setTxTime(hdr, &controls_[num_messages_ * CONTROL_SIZE], datagram.txtime);
+
+            messages_[num_messages_].msg_len = 0;
+            first_datagram_[num_messages_] = i;
+
+            num_messages_++;
+            i += run;
+        }
+    }
+
+    /** 
+     * @returns The number of datagrams, starting at first, that can be merged in a GSO 
+     * message: same endpoint and same size, only the last one can be smaller
+     */
+    size_t gsoRunLength(size_t first)
+    {
+        auto& head = datagrams_[first];
+        size_t run = 1;
+
+        while(first + run < datagrams_.size() && run < GSO_MAX_SEGMENTS && (run + 1) * head.size <= GSO_MAX_BYTES) {
+            auto& next = datagrams_[first + run];
+
+            if(next.endpoint != head.endpoint || next.socket != head.socket || next.size > head.size || datagrams_[first + run - 1].size != head.size)
+                break;
+
+            run++;
+        }
+
+        return run;
+    }
+
+    /** @returns The send flags of a socket, MSG_ZEROCOPY only for the sender socket */
+    inline int zeroCopyFlag(int socket)
+    {
+#ifdef MSG_ZEROCOPY
+        if(zerocopy_enabled_ && socket == sender_.nativeHandle())
+            return MSG_ZEROCOPY;
+#endif
+        return 0;
+    }
+
+    /** 
+     * Moves the buffers of count zerocopy messages sent, starting at first, to the 
+     * pinned queue. The kernel numbers every zerocopy message sent in order
+     */
+    void pinMessages(size_t first, size_t count)
+    {
+        for(auto message = first; message < first + count; message++) {
+            auto datagram = first_datagram_[message];
+            auto buffers = messages_[message].msg_hdr.msg_iovlen;
+
+            for(auto i = datagram; i < datagram + buffers; i++)
+                pinned_buffers_.push_back(std::move(datagrams_[i].buffer));
+
+            pinned_messages_.push_back({false, buffers});
+        }
+    }
+
+    /** Reads the zerocopy completions from the error queue, without blocking, and releases their buffers */
+    void reapZeroCopy()
+    {
+#ifdef SO_EE_ORIGIN_ZEROCOPY
+        uint8_t control[CMSG_SPACE(sizeof(struct sock_extended_err) + sizeof(struct sockaddr_in6))];
+
+        for(;;) {
+            struct msghdr msg;
+            memset(&msg, 0, sizeof(msg));
+            msg.msg_control = control;
+            msg.msg_controllen = sizeof(control);
+
+            if(recvmsg(sender_.nativeHandle(), &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0)
+                break;
+
+            for(auto cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+                if(!(cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_RECVERR) && 
+                    !(cmsg->cmsg_level == SOL_IPV6 && cmsg->cmsg_type == IPV6_RECVERR))
+                    continue;
+
+                struct sock_extended_err err;
+                memcpy(&err, CMSG_DATA(cmsg), sizeof(err));
+
+                if(err.ee_errno != 0 || err.ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+                    continue;
+
+                // Ids range [ee_info, ee_data], every message in it is complete
+                for(auto id = err.ee_info; id - err.ee_info <= err.ee_data - err.ee_info; id++) {
+                    auto index = static_cast<uint32_t>(id - pinned_first_id_);
+                    if(index < pinned_messages_.size())
+                        pinned_messages_[index].completed = true;
+                }
+
+                if((err.ee_code & SO_EE_CODE_ZEROCOPY_COPIED) && !zerocopy_copied_) {
+                    zerocopy_copied_ = true;
+                    Logger::get().info() << logclass(UDPBurstSender) << "the kernel copies the zerocopy sends (loopback or no NIC scatter-gather support)" << std::endl;
+                }
+            }
+        }
+
+        while(!pinned_messages_.empty() && pinned_messages_.front().completed) {
+            pinned_buffers_.erase(pinned_buffers_.begin(), pinned_buffers_.begin() + pinned_messages_.front().buffers);
+            pinned_messages_.pop_front();
+            pinned_first_id_++;
+        }
+#endif
+    }
+
+    /** @returns The socket a message is sent through */
+    inline int messageSocket(size_t message)
+    {
+        auto socket = datagrams_[first_datagram_[message]].socket;
+        return socket < 0 ? sender_.nativeHandle() : socket;
+    }
+
+    // Attaches the UDP_SEGMENT cmsg to a message
+    void setSegmentSize(struct msghdr& hdr, uint8_t* control, size_t segment_size)
+    {
+#ifdef UDP_SEGMENT
+        uint16_t size = static_cast<uint16_t>(segment_size);
+
+        hdr.msg_control = control;
+        hdr.msg_controllen = CMSG_SPACE(sizeof(uint16_t));
+
+        auto cmsg = CMSG_FIRSTHDR(&hdr);
+        cmsg->cmsg_level = SOL_UDP;
+        cmsg->cmsg_type = UDP_SEGMENT;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+        memcpy(CMSG_DATA(cmsg), &size, sizeof(uint16_t));
+#endif
+    }
+
+    // Attaches the SCM_TXTIME cmsg to a message
+    void setTxTime(struct msghdr& hdr, uint8_t* control, uint64_t txtime)
+    {
+#ifdef SCM_TXTIME
+        hdr.msg_control = control;
+        hdr.msg_controllen = CONTROL_SIZE;
+
+        auto cmsg = CMSG_FIRSTHDR(&hdr);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_TXTIME;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(uint64_t));
+        memcpy(CMSG_DATA(cmsg), &txtime, sizeof(uint64_t));
+#endif
+    }
+#endif
+};
+
+}
@@ -0,0 +1,383 @@
+//
+// Copyright (C) 2019 Adofo Martinez <adolfo at ipcaster dot net>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#pragma once
+
+#include <map>
+#include <array>
+#include <mutex>
+#include <memory>
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <cstring>
+
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/ioctl.h>
+#include <net/if.h>
+#include <arpa/inet.h>
+#endif
+
+#include "ipcaster/base/Exception.hpp"
+#include "ipcaster/base/Logger.hpp"
+#include "ipcaster/net/IP.hpp"
+
+namespace ipcaster
+{
+
+/**
+ * Builds complete Ethernet / IPv4 / UDP frames for the raw sender backends
+ * (PACKET_MMAP, AF_XDP), that bypass the kernel UDP / IP stack.
+ *
+ * The headers of every destination are built once (template) and only the
+ * lengths, IP identification and IP checksum are set per frame.
+ * The destinations must be IPv4 and registered with addDestination(), that
+ * takes the MAC of their next hop (the destination or its gateway) from the
+ * ARP table. Linux only.
+ */
+class UDPFrameBuilder
+{
+public:
+
+    // Ethernet + IPv4 + UDP headers
+    static constexpr size_t HEADERS_SIZE = 14 + 20 + 8;
+
+    /** Constructor
+     *
+     * Gets the addresses of the interface, and reserves a source UDP port
+     * with a regular socket so no one else uses it
+     *
+     * @param interface Name of the output network interface
+     *
+     * @throws std::exception Thrown on failure (unknown interface, no IPv4 address, ...)
+     */
+    UDPFrameBuilder(const std::string& interface)
+    : interface_(interface)
+    {
+#ifdef __linux__
+        int fd = socket(AF_INET, SOCK_DGRAM, 0);
+        if(fd < 0)
+            throw Exception(fndbg(UDPFrameBuilder) + "can't open socket: " + strerror(errno));
+
+        struct ifreq ifr;
+        memset(&ifr, 0, sizeof(ifr));
+        strncpy(ifr.ifr_name, interface_.c_str(), IFNAMSIZ - 1);
+
+        std::string error;
+
+        if(ioctl(fd, SIOCGIFINDEX, &ifr) < 0)
+            error = "unknown interface ";
+        else {
+            ifindex_ = ifr.ifr_ifindex;
+
+            if(ioctl(fd, SIOCGIFHWADDR, &ifr) < 0)
+                error = "can't get the MAC of ";
+            else {
+                memcpy(source_mac_, ifr.ifr_hwaddr.sa_data, 6);
+
+                if(ioctl(fd, SIOCGIFMTU, &ifr) < 0)
+                    error = "can't get the MTU of ";
+                else {
+                    max_frame_size_ = static_cast<size_t>(ifr.ifr_mtu) + 14;
+
+                    ifr.ifr_addr.sa_family = AF_INET;
+                    if(ioctl(fd, SIOCGIFADDR, &ifr) < 0)
+                        error = "no IPv4 address in ";
+                    else
+                        source_ip_ = reinterpret_cast<struct sockaddr_in*>(&ifr.ifr_addr)->sin_addr.s_addr;
+                }
+            }
+        }
+
+        close(fd);
+
+        if(!error.empty())
+            throw Exception(fndbg(UDPFrameBuilder) + error + interface_);
+
+        struct in_addr source_addr;
+        source_addr.s_addr = source_ip_;
+        io_service_ = std::make_unique<boost::asio::io_service>();
+        port_reservation_ = std::make_unique<ip::udp::socket>(*io_service_,
+            ip::udp::endpoint(ip::address::from_string(inet_ntoa(source_addr)), 0));
+        source_port_ = port_reservation_->local_endpoint().port();
+#else
+        throw Exception(fndbg(UDPFrameBuilder) + "raw frames are only supported on Linux");
+#endif
+    }
+
+    /**
+     * Resolves the MAC of a destination, must be called before building its frames
+     *
+     * Multicast destinations use their mapped MAC, unicast ones the ARP table entry
+     * of their next hop in the interface (the gateway of their route, if any).
+     *
+     * @param address Destination IP
+     *
+     * @throws std::exception If the address isn't IPv4 or its next hop has no ARP entry
+     */
+    void addDestination(const ip::address& address)
+    {
+        if(!address.is_v4())
+            throw Exception(fndbg(UDPFrameBuilder) + "only IPv4 destinations are supported, " + address.to_string());
+
+        std::array<uint8_t, 6> mac;
+        destinationMAC(address.to_v4(), mac.data());
+
+        std::lock_guard<std::mutex> lock(mutex_destinations_);
+
+        destinations_[address.to_v4()] = mac;
+    }
+
+    /** @returns The index of the interface */
+    inline int ifindex() const { return ifindex_; }
+
+    /** @returns The max ethernet frame size allowed by the interface MTU */
+    inline size_t maxFrameSize() const { return max_frame_size_; }
+
+    /**
+     * Writes the frame of a datagram
+     *
+     * @param frame Where the frame is written
+     *
+     * @param capacity Max frame size that can be written
+     *
+     * @param endpoint Target ip and port
+     *
+     * @param data Datagram payload
+     *
+     * @param size Size of the payload
+     *
+     * @returns The size of the frame, 0 if it doesn't fit in capacity or the MTU,
+     * or the destination wasn't added with addDestination()
+     */
+    size_t build(uint8_t* frame, size_t capacity, const ip::udp::endpoint& endpoint, const void* data, size_t size)
+    {
+        auto frame_size = size + HEADERS_SIZE;
+
+        if(frame_size > capacity || frame_size > max_frame_size_)
+            return 0;
+
+        auto headers = headerTemplate(endpoint);
+        if(!headers)
+            return 0;
+
+        memcpy(frame, headers, HEADERS_SIZE);
+        memcpy(frame + HEADERS_SIZE, data, size);
+        completeHeaders(frame, size);
+
+        return frame_size;
+    }
+
+private:
+
+    // Output interface name
+    std::string interface_;
+
+    // Interface index
+    int ifindex_ = 0;
+
+    // Max ethernet frame size, from the interface MTU
+    size_t max_frame_size_ = 0;
+
+    // Interface addresses, source of every frame
+    uint8_t source_mac_[6];
+    uint32_t source_ip_ = 0;
+
+    // Source UDP port, reserved with a regular socket
+    std::unique_ptr<boost::asio::io_service> io_service_;
+    std::unique_ptr<ip::udp::socket> port_reservation_;
+    uint16_t source_port_ = 0;
+
+    // IPv4 identification counter
+    uint16_t ip_id_ = 0;
+
+    // MAC of the next hop of every added destination
+    std::map<ip::address_v4, std::array<uint8_t, 6>> destinations_;
+
+    // Protects destinations_, added from the threads creating the streams
+    std::mutex mutex_destinations_;
+
+    // Pre-built headers of every destination, only used by the sending thread
+    std::map<ip::udp::endpoint, std::array<uint8_t, HEADERS_SIZE>> templates_;
+
+    /** 
+     * @returns The headers template of a destination, built on its first datagram, 
+     * nullptr if the destination wasn't added
+     */
+    const uint8_t* headerTemplate(const ip::udp::endpoint& endpoint)
+    {
+        auto it = templates_.find(endpoint);
+        if(it != templates_.end())
+            return it->second.data();
+
+        if(!endpoint.address().is_v4())
+            return nullptr;
+
+        std::array<uint8_t, HEADERS_SIZE> headers;
+        headers.fill(0);
+
+        // Ethernet
+        {
+            std::lock_guard<std::mutex> lock(mutex_destinations_);
+
+            auto destination = destinations_.find(endpoint.address().to_v4());
+            if(destination == destinations_.end())
+                return nullptr;
+
+            memcpy(&headers[0], destination->second.data(), 6);
+        }
+        memcpy(&headers[6], source_mac_, 6);
+        headers[12] = 0x08;
+        headers[13] = 0x00;
+
+        // IPv4, total length, identification and checksum are set per datagram
+        auto ip = &headers[14];
+        ip[0] = 0x45;
+        ip[6] = 0x40; // Don't fragment
+        ip[8] = endpoint.address().is_multicast() ? 16 : 64;
+        ip[9] = 17; // UDP
+        memcpy(&ip[12], &source_ip_, 4);
+        auto destination_ip = htonl(endpoint.address().to_v4().to_ulong());
+        memcpy(&ip[16], &destination_ip, 4);
+
+        // UDP, length set per datagram, no checksum
+        auto udp = &headers[34];
+        udp[0] = static_cast<uint8_t>(source_port_ >> 8);
+        udp[1] = static_cast<uint8_t>(source_port_);
+        udp[2] = static_cast<uint8_t>(endpoint.port() >> 8);
+        udp[3] = static_cast<uint8_t>(endpoint.port());
+
+        return templates_.emplace(endpoint, headers).first->second.data();
+    }
+
+    /** Sets the per datagram fields of the IP and UDP headers */
+    void completeHeaders(uint8_t* packet, size_t payload_size)
+    {
+        auto ip = packet + 14;
+        auto udp = packet + 34;
+
+        uint16_t ip_length = static_cast<uint16_t>(payload_size + 28);
+        uint16_t udp_length = static_cast<uint16_t>(payload_size + 8);
+
+        ip[2] = static_cast<uint8_t>(ip_length >> 8);
+        ip[3] = static_cast<uint8_t>(ip_length);
+        ip[4] = static_cast<uint8_t>(ip_id_ >> 8);
+        ip[5] = static_cast<uint8_t>(ip_id_);
+        ip_id_++;
+
+        uint32_t sum = 0;
+        for(size_t i = 0; i < 20; i += 2)
+            sum += (ip[i] << 8) | ip[i + 1];
+        while(sum >> 16)
+            sum = (sum & 0xFFFF) + (sum >> 16);
+        uint16_t checksum = static_cast<uint16_t>(~sum);
+        ip[10] = static_cast<uint8_t>(checksum >> 8);
+        ip[11] = static_cast<uint8_t>(checksum);
+
+        udp[4] = static_cast<uint8_t>(udp_length >> 8);
+        udp[5] = static_cast<uint8_t>(udp_length);
+    }
+
+    /**
+     * Gets the destination MAC of an IP: the mapped MAC for multicast,
+     * the ARP table entry of the next hop for unicast
+     *
+     * @throws std::exception If the next hop has no complete ARP entry
+     */
+    void destinationMAC(const ip::address_v4& address, uint8_t* mac)
+    {
+        auto ip = address.to_bytes();
+
+        if(address.is_multicast()) {
+            uint8_t multicast_mac[6] = { 0x01, 0x00, 0x5e, static_cast<uint8_t>(ip[1] & 0x7f), ip[2], ip[3] };
+            memcpy(mac, multicast_mac, 6);
+            return;
+        }
+
+        // Loopback interface, no link addresses
+        if(address.is_loopback()) {
+            memset(mac, 0, 6);
+            return;
+        }
+
+        auto next_hop = nextHop(address);
+
+        std::ifstream arp("/proc/net/arp");
+        std::string line;
+        std::getline(arp, line); // Skip the titles
+
+        while(std::getline(arp, line)) {
+            std::istringstream fields(line);
+            std::string entry_ip, hw_type, flags, entry_mac, mask, device;
+            fields >> entry_ip >> hw_type >> flags >> entry_mac >> mask >> device;
+
+            // ATF_COM, the entry is resolved
+            bool complete = strtoul(flags.c_str(), nullptr, 16) & 0x2;
+
+            unsigned int bytes[6];
+            if(entry_ip == next_hop.to_string() && device == interface_ && complete &&
+                sscanf(entry_mac.c_str(), "%x:%x:%x:%x:%x:%x", &bytes[0], &bytes[1], &bytes[2], &bytes[3], &bytes[4], &bytes[5]) == 6) {
+                for(int i = 0; i < 6; i++)
+                    mac[i] = static_cast<uint8_t>(bytes[i]);
+                return;
+            }
+        }
+
+        throw Exception(fndbg(UDPFrameBuilder) + "no ARP entry in " + interface_ + " for " + next_hop.to_string() + 
+            (next_hop == address ? "" : " (gateway of " + address.to_string() + ")") + ", ping it to resolve it");
+    }
+
+    /** @returns The gateway of the most specific route of the interface to address, address itself if it's on link */
+    ip::address_v4 nextHop(const ip::address_v4& address)
+    {
+        // The routes table fields are hex in network byte order
+        uint32_t destination = htonl(address.to_ulong());
+
+        std::ifstream routes("/proc/net/route");
+        std::string line;
+        std::getline(routes, line); // Skip the titles
+
+        uint32_t gateway = 0;
+        int best_prefix = -1;
+
+        while(std::getline(routes, line)) {
+            std::istringstream fields(line);
+            std::string device, route_destination, route_gateway, flags, refcnt, use, metric, mask;
+            fields >> device >> route_destination >> route_gateway >> flags >> refcnt >> use >> metric >> mask;
+
+            if(device != interface_)
+                continue;
+
+            auto route_flags = strtoul(flags.c_str(), nullptr, 16);
+            auto route_mask = static_cast<uint32_t>(strtoul(mask.c_str(), nullptr, 16));
+            int prefix = __builtin_popcount(route_mask);
+
+            // RTF_UP
+            if(!(route_flags & 0x1) || (destination & route_mask) != static_cast<uint32_t>(strtoul(route_destination.c_str(), nullptr, 16)) || prefix <= best_prefix)
+                continue;
+
+            best_prefix = prefix;
+            // RTF_GATEWAY
+            gateway = route_flags & 0x2 ? static_cast<uint32_t>(strtoul(route_gateway.c_str(), nullptr, 16)) : 0;
+        }
+
+        return gateway ? ip::address_v4(ntohl(gateway)) : address;
+    }
+};
+
+}
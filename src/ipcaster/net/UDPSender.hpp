@@ -63,6 +63,23 @@ public:
         return socket_->send_to(buffers, endpoint, 0);
     }
 
+    /**
+     * Connects the socket to an endpoint, so the kernel resolves the route 
+     * once and reports the endpoint errors (e.g. ICMP port unreachable)
+     * in the next sends
+     *
+     * @param endpoint Target ip and port
+     *
+     * @throws UDPSender::SystemError Thrown on failure.
+     */
+    void connect(const ip::udp::endpoint& endpoint)
+    {
+        socket_->connect(endpoint);
+    }
+
+    /** @returns The native socket handle, for platform specific send paths */
+    inline boost::asio::ip::udp::socket::native_handle_type nativeHandle() { return socket_->native_handle(); }
+
 private:
 
     std::unique_ptr<boost::asio::io_service> io_service_;
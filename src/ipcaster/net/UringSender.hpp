@@ -0,0 +1,377 @@
+//
+// Copyright (C) 2019 Adofo Martinez <adolfo at ipcaster dot net>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#pragma once
+
+#include <chrono>
+#include <vector>
+#include <cstring>
+
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#endif
+
+#include "ipcaster/base/Exception.hpp"
+#include "ipcaster/net/IP.hpp"
+#include "ipcaster/net/UDPSender.hpp"
+#include "ipcaster/net/BurstSender.hpp"
+
+namespace ipcaster
+{
+
+/**
+ * Asynchronous sender backend based on io_uring.
+ *
+ * Every datagram of a burst is queued as a sendmsg operation in the
+ * submission queue and the whole burst is submitted with a single
+ * io_uring_enter() call that doesn't wait for the sends to complete.
+ * The completions are reaped, without blocking, in the next flush().
+ *
+ * The payloads are copied to slots owned by the sender, as the caller
+ * releases its buffers as soon as flush() returns.
+ * Linux only (kernel 5.3 or newer).
+ */
+class UringSender : public BurstSender
+{
+    using Clock = std::chrono::steady_clock;
+
+public:
+
+    // Default number of submission queue entries (max datagrams in flight)
+    static constexpr unsigned int DEFAULT_ENTRIES = 1024;
+
+    /** Constructor
+     *
+     * @param entries Number of submission queue entries
+     *
+     * @throws std::exception Thrown if io_uring is not available
+     */
+    UringSender(unsigned int entries = DEFAULT_ENTRIES)
+    {
+#ifdef __linux__
+        struct io_uring_params params;
+        memset(&params, 0, sizeof(params));
+
+        ring_fd_ = static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+        if(ring_fd_ < 0)
+            throw Exception(fndbg(UringSender) + "io_uring not available: " + strerror(errno));
+
+        try {
+            setup(params);
+        }
+        catch(...) {
+            release();
+            throw;
+        }
+#else
+        throw Exception(fndbg(UringSender) + "io_uring is only supported on Linux");
+#endif
+    }
+
+    ~UringSender()
+    {
+#ifdef __linux__
+        // Don't release the slots while the kernel may still be using them
+        while(in_flight_ && waitCompletions(1));
+
+        release();
+#endif
+    }
+
+    UringSender(const UringSender&) = delete;
+    UringSender& operator=(const UringSender&) = delete;
+
+    /**
+     * Copies the datagram to a free slot and queues its sendmsg operation.
+     * If all the slots are in flight, the queued operations are submitted
+     * and the sender waits for a completion.
+     */
+    void push(const ip::udp::endpoint& endpoint, const void* data, size_t size, uint64_t /*txtime*/ = 0, int socket = -1) override
+    {
+#ifdef __linux__
+        if(free_slots_.empty()) {
+            reapCompletions();
+
+            if(free_slots_.empty()) {
+                submit();
+                if(in_flight_)
+                    waitCompletions(1);
+            }
+
+            if(free_slots_.empty()) {
+                send_failures_++;
+                return;
+            }
+        }
+
+        auto index = free_slots_.back();
+        free_slots_.pop_back();
+
+        auto& slot = slots_[index];
+
+        if(slot.data.size() < size)
+            slot.data.resize(size);
+        memcpy(slot.data.data(), data, size);
+
+        slot.endpoint = endpoint;
+        slot.iov.iov_base = slot.data.data();
+        slot.iov.iov_len = size;
+
+        memset(&slot.msg, 0, sizeof(slot.msg));
+        // A connected socket already has the destination
+        if(socket < 0) {
+            slot.msg.msg_name = slot.endpoint.data();
+            slot.msg.msg_namelen = static_cast<socklen_t>(slot.endpoint.size());
+        }
+        slot.msg.msg_iov = &slot.iov;
+        slot.msg.msg_iovlen = 1;
+
+        auto tail = sq_local_tail_;
+        auto& sqe = sqes_[tail & *sq_mask_];
+
+        memset(&sqe, 0, sizeof(sqe));
+        sqe.opcode = IORING_OP_SENDMSG;
+        sqe.fd = socket < 0 ? sender_.nativeHandle() : socket;
+        sqe.addr = reinterpret_cast<uint64_t>(&slot.msg);
+        sqe.len = 1;
+        sqe.user_data = index;
+
+        sq_array_[tail & *sq_mask_] = tail & *sq_mask_;
+        sq_local_tail_ = tail + 1;
+        to_submit_++;
+#endif
+    }
+
+    /**
+     * Reaps the completions of the previous bursts and submits the
+     * queued operations, without waiting for them to complete
+     *
+     * @returns The number of system calls used
+     */
+    size_t flush() override
+    {
+        size_t syscalls = 0;
+
+#ifdef __linux__
+        reapCompletions();
+
+        if(to_submit_) {
+            auto t_start = Clock::now();
+            submit();
+            submit_latency_ = Clock::now() - t_start;
+            syscalls++;
+        }
+#endif
+
+        return syscalls;
+    }
+
+    uint64_t sendFailures() const override { return send_failures_; }
+
+    std::chrono::nanoseconds submitLatency() const override { return submit_latency_; }
+
+    std::chrono::nanoseconds completeLatency() const override { return complete_latency_; }
+
+private:
+
+    // Socket used to send
+    UDPSender sender_;
+
+    // io_uring file descriptor
+    int ring_fd_ = -1;
+
+    // A datagram copy and its sendmsg arguments, alive until the operation completes
+    struct Slot
+    {
+        std::vector<uint8_t> data;
+        ip::udp::endpoint endpoint;
+        struct iovec iov;
+        struct msghdr msg;
+        Clock::time_point submit_time;
+    };
+
+    std::vector<Slot> slots_;
+
+    // Indexes of the slots not in flight
+    std::vector<size_t> free_slots_;
+
+    // Operations submitted and not completed yet
+    size_t in_flight_ = 0;
+
+    // Operations queued and not submitted yet
+    unsigned int to_submit_ = 0;
+
+    // Datagrams that failed to be sent
+    uint64_t send_failures_ = 0;
+
+    // Time spent in the last submission
+    std::chrono::nanoseconds submit_latency_ = std::chrono::nanoseconds(0);
+
+    // Max time from submission to completion of the operations reaped in the last flush
+    std::chrono::nanoseconds complete_latency_ = std::chrono::nanoseconds(0);
+
+#ifdef __linux__
+    // Mapped rings
+    void* sq_ring_ = nullptr;
+    size_t sq_ring_size_ = 0;
+    void* cq_ring_ = nullptr;
+    size_t cq_ring_size_ = 0;
+    struct io_uring_sqe* sqes_ = nullptr;
+    size_t sqes_size_ = 0;
+
+    // Submission queue
+    unsigned int* sq_tail_ = nullptr;
+    unsigned int* sq_mask_ = nullptr;
+    unsigned int* sq_array_ = nullptr;
+    unsigned int sq_local_tail_ = 0;
+
+    // Completion queue
+    unsigned int* cq_head_ = nullptr;
+    unsigned int* cq_tail_ = nullptr;
+    unsigned int* cq_mask_ = nullptr;
+    struct io_uring_cqe* cqes_ = nullptr;
+
+    /** Maps the rings */
+    void setup(const struct io_uring_params& params)
+    {
+        sq_ring_size_ = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+        cq_ring_size_ = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+
+        bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+        if(single_mmap)
+            sq_ring_size_ = cq_ring_size_ = std::max(sq_ring_size_, cq_ring_size_);
+
+        sq_ring_ = map(sq_ring_size_, IORING_OFF_SQ_RING);
+        cq_ring_ = single_mmap ? sq_ring_ : map(cq_ring_size_, IORING_OFF_CQ_RING);
+
+        sqes_size_ = params.sq_entries * sizeof(struct io_uring_sqe);
+        sqes_ = static_cast<struct io_uring_sqe*>(map(sqes_size_, IORING_OFF_SQES));
+
+        auto sq = static_cast<uint8_t*>(sq_ring_);
+        sq_tail_ = reinterpret_cast<unsigned int*>(sq + params.sq_off.tail);
+        sq_mask_ = reinterpret_cast<unsigned int*>(sq + params.sq_off.ring_mask);
+        sq_array_ = reinterpret_cast<unsigned int*>(sq + params.sq_off.array);
+        sq_local_tail_ = *sq_tail_;
+
+        auto cq = static_cast<uint8_t*>(cq_ring_);
+        cq_head_ = reinterpret_cast<unsigned int*>(cq + params.cq_off.head);
+        cq_tail_ = reinterpret_cast<unsigned int*>(cq + params.cq_off.tail);
+        cq_mask_ = reinterpret_cast<unsigned int*>(cq + params.cq_off.ring_mask);
+        cqes_ = reinterpret_cast<struct io_uring_cqe*>(cq + params.cq_off.cqes);
+
+        // As many slots as submission entries, the completion queue (2x) never overflows
+        slots_.resize(params.sq_entries);
+        for(size_t i = slots_.size(); i > 0; i--)
+            free_slots_.push_back(i - 1);
+    }
+
+    /** Maps a region of the io_uring */
+    void* map(size_t size, off_t offset)
+    {
+        auto ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd_, offset);
+        if(ptr == MAP_FAILED)
+            throw Exception(fndbg(UringSender) + "can't map the io_uring: " + strerror(errno));
+
+        return ptr;
+    }
+
+    /** Unmaps the rings and closes the io_uring */
+    void release()
+    {
+        if(sqes_)
+            munmap(sqes_, sqes_size_);
+        if(cq_ring_ && cq_ring_ != sq_ring_)
+            munmap(cq_ring_, cq_ring_size_);
+        if(sq_ring_)
+            munmap(sq_ring_, sq_ring_size_);
+
+        sqes_ = nullptr;
+        cq_ring_ = nullptr;
+        sq_ring_ = nullptr;
+
+        close(ring_fd_);
+    }
+
+    /** Publishes the queued operations to the kernel */
+    void submit()
+    {
+        if(!to_submit_)
+            return;
+
+        auto now = Clock::now();
+        for(unsigned int i = 0; i < to_submit_; i++)
+            slots_[sqes_[(sq_local_tail_ - to_submit_ + i) & *sq_mask_].user_data].submit_time = now;
+
+        __atomic_store_n(sq_tail_, sq_local_tail_, __ATOMIC_RELEASE);
+
+        auto submitted = syscall(__NR_io_uring_enter, ring_fd_, to_submit_, 0, 0, nullptr, 0);
+
+        // On error nothing was consumed, the operations remain queued for the next submission
+        if(submitted < 0)
+            return;
+
+        in_flight_ += static_cast<size_t>(submitted);
+        to_submit_ -= static_cast<unsigned int>(submitted);
+    }
+
+    /** Blocks until at least count operations have completed, then reaps them
+     * @returns false on error
+     */
+    bool waitCompletions(unsigned int count)
+    {
+        if(syscall(__NR_io_uring_enter, ring_fd_, 0, count, IORING_ENTER_GETEVENTS, nullptr, 0) < 0 && errno != EINTR)
+            return false;
+
+        reapCompletions();
+
+        return true;
+    }
+
+    /** Frees the slots of the completed operations, without blocking */
+    void reapCompletions()
+    {
+        auto head = *cq_head_;
+        auto tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+
+        if(head == tail)
+            return;
+
+        auto now = Clock::now();
+        complete_latency_ = std::chrono::nanoseconds(0);
+
+        for(; head != tail; head++) {
+            auto& cqe = cqes_[head & *cq_mask_];
+            auto index = static_cast<size_t>(cqe.user_data);
+
+            if(cqe.res < 0)
+                send_failures_++;
+
+            complete_latency_ = std::max(complete_latency_, std::chrono::duration_cast<std::chrono::nanoseconds>(now - slots_[index].submit_time));
+
+            free_slots_.push_back(index);
+            in_flight_--;
+        }
+
+        __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+    }
+#endif
+};
+
+}
@@ -0,0 +1,354 @@
+//
+// Copyright (C) 2019 Adofo Martinez <adolfo at ipcaster dot net>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstring>
+
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/mman.h>
+#include <linux/if_xdp.h>
+#endif
+
+#include "ipcaster/base/Exception.hpp"
+#include "ipcaster/base/Logger.hpp"
+#include "ipcaster/net/IP.hpp"
+#include "ipcaster/net/BurstSender.hpp"
+#include "ipcaster/net/UDPFrameBuilder.hpp"
+
+#ifndef SOL_XDP
+#define SOL_XDP 283
+#endif
+
+#ifndef AF_XDP
+#define AF_XDP 44
+#endif
+
+namespace ipcaster
+{
+
+/**
+ * Raw sender backend based on an AF_XDP socket (XSK).
+ *
+ * The frames (see UDPFrameBuilder) are written in a UMEM region shared
+ * with the kernel and their descriptors submitted to the XSK TX ring,
+ * bypassing the kernel UDP / IP stack. The UMEM frames are recycled
+ * through the completion ring.
+ *
+ * The driver zero-copy (native) mode is used when supported, otherwise
+ * the kernel falls back to the copy (generic / SKB) mode, available on
+ * any interface (veth included). TX only, so no XDP program is needed.
+ * Requires CAP_NET_RAW. Linux only.
+ */
+class XDPSender : public BurstSender
+{
+public:
+
+    // Size of an UMEM frame, holds a full ethernet frame
+    static constexpr size_t FRAME_SIZE = 2048;
+
+    // Default number of UMEM frames, also the size of the rings (power of 2)
+    static constexpr size_t DEFAULT_FRAME_COUNT = 4096;
+
+    /** Constructor
+     *
+     * @param interface Name of the output network interface
+     *
+     * @param queue Queue of the interface the socket is bound to
+     *
+     * @param frame_count Number of UMEM frames, rounded up to a power of 2
+     *
+     * @throws std::exception Thrown on failure (no permissions, unknown interface, ...)
+     */
+    XDPSender(const std::string& interface, uint32_t queue = 0, size_t frame_count = DEFAULT_FRAME_COUNT)
+    : frame_builder_(interface)
+    {
+#ifdef __linux__
+        frame_count_ = 1;
+        while(frame_count_ < frame_count)
+            frame_count_ <<= 1;
+
+        fd_ = socket(AF_XDP, SOCK_RAW, 0);
+        if(fd_ < 0)
+            throw Exception(fndbg(XDPSender) + "can't open AF_XDP socket: " + strerror(errno));
+
+        try {
+            setup(queue);
+        }
+        catch(...) {
+            release();
+            throw;
+        }
+#else
+        throw Exception(fndbg(XDPSender) + "AF_XDP is only supported on Linux");
+#endif
+    }
+
+    ~XDPSender()
+    {
+#ifdef __linux__
+        release();
+#endif
+    }
+
+    XDPSender(const XDPSender&) = delete;
+    XDPSender& operator=(const XDPSender&) = delete;
+
+    /** Resolves the MAC of the destination, see UDPFrameBuilder::addDestination() */
+    void addDestination(const ip::address& address) override
+    {
+        frame_builder_.addDestination(address);
+    }
+
+    /**
+     * Writes the frame of a datagram in a free UMEM frame and queues its
+     * descriptor in the TX ring. If there's no free frame or the datagram
+     * doesn't fit in a frame, the datagram is dropped and accounted as a failure.
+     */
+    void push(const ip::udp::endpoint& endpoint, const void* data, size_t size, uint64_t /*txtime*/ = 0, int /*socket*/ = -1) override
+    {
+#ifdef __linux__
+        if(free_frames_.empty())
+            reclaimFrames();
+
+        // The TX ring has as many slots as UMEM frames, so a free frame means a free slot
+        if(free_frames_.empty()) {
+            send_failures_++;
+            return;
+        }
+
+        auto addr = free_frames_.back();
+        auto frame_size = frame_builder_.build(umem_ + addr, FRAME_SIZE, endpoint, data, size);
+
+        if(!frame_size) {
+            send_failures_++;
+            return;
+        }
+
+        free_frames_.pop_back();
+
+        auto& desc = static_cast<struct xdp_desc*>(tx_.descs)[tx_producer_ & tx_.mask];
+        desc.addr = addr;
+        desc.len = static_cast<uint32_t>(frame_size);
+        desc.options = 0;
+
+        tx_producer_++;
+        pending_++;
+#endif
+    }
+
+    /**
+     * Publishes the descriptors queued since the last flush and kicks the
+     * kernel to send them
+     *
+     * @returns The number of system calls used
+     */
+    size_t flush() override
+    {
+        size_t syscalls = 0;
+
+#ifdef __linux__
+        if(!pending_)
+            return 0;
+
+        __atomic_store_n(tx_.producer, tx_producer_, __ATOMIC_RELEASE);
+
+        ring_occupancy_ = static_cast<float>(frame_count_ - free_frames_.size()) / frame_count_;
+
+        // The copy mode sends a limited batch per call, kick until the ring is drained
+        // or the kernel makes no progress (the rest goes with the next flush)
+        uint32_t last_consumer = __atomic_load_n(tx_.consumer, __ATOMIC_ACQUIRE);
+
+        for(;;) {
+            auto ret = sendto(fd_, nullptr, 0, MSG_DONTWAIT, nullptr, 0);
+            syscalls++;
+
+            if(ret < 0 && errno != EAGAIN && errno != EBUSY && errno != ENOBUFS) {
+                send_failures_ += pending_;
+                break;
+            }
+
+            auto consumer = __atomic_load_n(tx_.consumer, __ATOMIC_ACQUIRE);
+            if(consumer == tx_producer_ || consumer == last_consumer)
+                break;
+
+            last_consumer = consumer;
+        }
+
+        pending_ = 0;
+
+        reclaimFrames();
+#endif
+
+        return syscalls;
+    }
+
+    float ringOccupancy() const override { return ring_occupancy_; }
+
+    uint64_t sendFailures() const override { return send_failures_; }
+
+    /** @returns true if the driver zero-copy mode is in use */
+    inline bool zeroCopy() const { return zero_copy_; }
+
+private:
+
+    // Builds the frames of the datagrams
+    UDPFrameBuilder frame_builder_;
+
+    // XSK socket
+    int fd_ = -1;
+
+    // Packet buffers shared with the kernel
+    uint8_t* umem_ = nullptr;
+    size_t frame_count_ = 0;
+
+    // Addresses (offsets in umem_) of the frames not owned by the kernel
+    std::vector<uint64_t> free_frames_;
+
+    // Local copy of the TX ring producer index
+    uint32_t tx_producer_ = 0;
+
+    // Descriptors queued since the last flush
+    size_t pending_ = 0;
+
+    // Fraction of the UMEM frames in flight at the last flush
+    float ring_occupancy_ = 0;
+
+    // Datagrams dropped or rejected by the kernel
+    uint64_t send_failures_ = 0;
+
+    // Driver zero-copy mode
+    bool zero_copy_ = false;
+
+    // A ring mapped from the kernel
+    struct Ring
+    {
+        uint32_t* producer = nullptr;
+        uint32_t* consumer = nullptr;
+        void* descs = nullptr;
+        uint32_t mask = 0;
+        void* map = nullptr;
+        size_t map_size = 0;
+    };
+
+    // TX ring (xdp_desc) and completion ring (UMEM addresses)
+    Ring tx_;
+    Ring completion_;
+
+#ifdef __linux__
+    /** Unmaps the rings and the UMEM and closes the socket */
+    void release()
+    {
+        for(auto ring : { &tx_, &completion_ }) {
+            if(ring->map)
+                munmap(ring->map, ring->map_size);
+            ring->map = nullptr;
+        }
+
+        close(fd_);
+
+        if(umem_)
+            munmap(umem_, frame_count_ * FRAME_SIZE);
+        umem_ = nullptr;
+    }
+
+    /** Maps a ring of the socket */
+    void mapRing(Ring& ring, const struct xdp_ring_offset& offsets, size_t desc_size, off_t pgoff)
+    {
+        ring.map_size = offsets.desc + frame_count_ * desc_size;
+        auto map = mmap(nullptr, ring.map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, pgoff);
+        if(map == MAP_FAILED)
+            throw Exception(fndbg(XDPSender) + "can't map ring: " + strerror(errno));
+
+        ring.map = map;
+        ring.producer = reinterpret_cast<uint32_t*>(static_cast<uint8_t*>(map) + offsets.producer);
+        ring.consumer = reinterpret_cast<uint32_t*>(static_cast<uint8_t*>(map) + offsets.consumer);
+        ring.descs = static_cast<uint8_t*>(map) + offsets.desc;
+        ring.mask = static_cast<uint32_t>(frame_count_ - 1);
+    }
+
+    /** Registers the UMEM, creates the rings and binds the socket to the interface queue */
+    void setup(uint32_t queue)
+    {
+        auto umem = mmap(nullptr, frame_count_ * FRAME_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if(umem == MAP_FAILED)
+            throw Exception(fndbg(XDPSender) + "can't allocate UMEM: " + strerror(errno));
+        umem_ = static_cast<uint8_t*>(umem);
+
+        struct xdp_umem_reg reg;
+        memset(&reg, 0, sizeof(reg));
+        reg.addr = reinterpret_cast<uint64_t>(umem_);
+        reg.len = frame_count_ * FRAME_SIZE;
+        reg.chunk_size = FRAME_SIZE;
+
+        if(setsockopt(fd_, SOL_XDP, XDP_UMEM_REG, &reg, sizeof(reg)) < 0)
+            throw Exception(fndbg(XDPSender) + "can't register UMEM: " + strerror(errno));
+
+        // The fill ring is required by bind() although it's not used for TX only
+        int ring_size = static_cast<int>(frame_count_);
+        if(setsockopt(fd_, SOL_XDP, XDP_UMEM_FILL_RING, &ring_size, sizeof(ring_size)) < 0 ||
+           setsockopt(fd_, SOL_XDP, XDP_UMEM_COMPLETION_RING, &ring_size, sizeof(ring_size)) < 0 ||
+           setsockopt(fd_, SOL_XDP, XDP_TX_RING, &ring_size, sizeof(ring_size)) < 0)
+            throw Exception(fndbg(XDPSender) + "can't create rings: " + strerror(errno));
+
+        struct xdp_mmap_offsets offsets;
+        socklen_t len = sizeof(offsets);
+        if(getsockopt(fd_, SOL_XDP, XDP_MMAP_OFFSETS, &offsets, &len) < 0)
+            throw Exception(fndbg(XDPSender) + "can't get ring offsets: " + strerror(errno));
+
+        mapRing(tx_, offsets.tx, sizeof(struct xdp_desc), XDP_PGOFF_TX_RING);
+        mapRing(completion_, offsets.cr, sizeof(uint64_t), XDP_UMEM_PGOFF_COMPLETION_RING);
+
+        // Without XDP_COPY / XDP_ZEROCOPY the kernel uses zero-copy if the driver supports it
+        struct sockaddr_xdp addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sxdp_family = AF_XDP;
+        addr.sxdp_ifindex = static_cast<uint32_t>(frame_builder_.ifindex());
+        addr.sxdp_queue_id = queue;
+
+        if(bind(fd_, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) < 0)
+            throw Exception(fndbg(XDPSender) + "can't bind to queue " + std::to_string(queue) + ": " + strerror(errno));
+
+        struct xdp_options options;
+        len = sizeof(options);
+        zero_copy_ = getsockopt(fd_, SOL_XDP, XDP_OPTIONS, &options, &len) == 0 && (options.flags & XDP_OPTIONS_ZEROCOPY);
+
+        Logger::get().info() << logclass(XDPSender) << "AF_XDP socket bound to queue " << queue << (zero_copy_ ? " (zero-copy mode)" : " (copy mode)") << std::endl;
+
+        free_frames_.reserve(frame_count_);
+        for(size_t i = frame_count_; i > 0; i--)
+            free_frames_.push_back((i - 1) * FRAME_SIZE);
+    }
+
+    /** Takes back the frames already sent by the kernel (completion ring) */
+    void reclaimFrames()
+    {
+        auto producer = __atomic_load_n(completion_.producer, __ATOMIC_ACQUIRE);
+        auto consumer = *completion_.consumer;
+
+        for(; consumer != producer; consumer++)
+            free_frames_.push_back(static_cast<uint64_t*>(completion_.descs)[consumer & completion_.mask]);
+
+        __atomic_store_n(completion_.consumer, consumer, __ATOMIC_RELEASE);
+    }
+#endif
+};
+
+}
@@ -32,6 +32,7 @@
 #include <cstddef>
 #include <string.h>
 
+#include "ipcaster/base/BlockPool.hpp"
 #include "ipcaster/mpeg2-ts/MPEG2TSBuffer.hpp"
 #include "ipcaster/mpeg2-ts/MPEG2TSFilters.hpp"
 #include "ipcaster/net/Datagram.hpp"
@@ -53,11 +54,20 @@ class SMPTE2022Part2Encapsulator
 
 public:
 
+    // Size of the pool blocks, fits a Datagram or a MPEG2TSBuffer with its shared_ptr control block
+    static constexpr size_t POOL_BLOCK_SIZE = 256;
+
+    // Datagrams slots of every carry buffer, see storeUnfinishedDatagram()
+    static constexpr size_t CARRY_DATAGRAMS = 64;
+
     /** Constructor
      * @param consumer Reference to object where datagram buffers will be pushed
      */
     SMPTE2022Part2Encapsulator(DatagramConsumer& consumer)
-        : consumer_(consumer)
+        :   pool_(std::make_shared<BlockPool>(POOL_BLOCK_SIZE)),
+            datagram_allocator_(pool_),
+            payload_allocator_(pool_),
+            consumer_(consumer)
     {
         ts_packets_per_datagram_ = 7;
     }
@@ -76,7 +86,6 @@ public:
 
         auto payload_size = ts_packets_per_datagram_*ts_buffer->packetSize();
         auto num_packets = ts_buffer->numPackets();
-        auto datagrams = std::make_shared<std::vector<Datagram>>();
         Clock::time_point send_tick;
 
         size_t pkt_index = 0;
@@ -89,9 +98,9 @@ public:
 
             // The payload of the datagram is a number of ts packets defined by ts_packets_per_datagram_
             // so a child reference is created to point those packets, and then pushed to the consumer
-            auto payload = ts_buffer->makeChild(pkt_index, ts_packets_per_datagram_, ts_packets_per_datagram_);
+            auto payload = ts_buffer->makeChild(pkt_index, ts_packets_per_datagram_, ts_packets_per_datagram_, payload_allocator_);
 
-            consumer_.push(std::make_shared<Datagram>("", 0, payload, sendTick(ts_buffer->timestamp(pkt_index))));
+            consumer_.push(std::allocate_shared<Datagram>(datagram_allocator_, payload, sendTick(ts_buffer->timestamp(pkt_index))));
         }
 
         auto remaining_packets = num_packets - pkt_index;
@@ -149,6 +158,18 @@ private:
     // Datagram partially full 
     std::shared_ptr<Datagram> unfinished_datagram_;
 
+    // Recycles the datagrams and their payload views once the consumer releases them 
+    // (the allocators keep the pool alive while any of them is in use)
+    std::shared_ptr<BlockPool> pool_;
+    PoolAllocator<Datagram> datagram_allocator_;
+    PoolAllocator<MPEG2TSBuffer> payload_allocator_;
+
+    // Storage of the datagrams completed across two input buffers, carved in datagram slots
+    std::shared_ptr<MPEG2TSBuffer> carry_buffer_;
+
+    // Next free packet of carry_buffer_
+    size_t carry_next_packet_ = 0;
+
     // Reference to the consumer object where datagrams will be pushed
     DatagramConsumer& consumer_;
 
@@ -198,10 +219,21 @@ private:
      */
     void storeUnfinishedDatagram(std::shared_ptr<MPEG2TSBuffer> ts_buffer, size_t pkt_index, size_t num_packets)
     {
-        auto payload = std::make_shared<MPEG2TSBuffer>(ts_packets_per_datagram_, ts_buffer->packetSize());
-        unfinished_datagram_ = std::make_shared<Datagram>("", 0, payload, sendTick(ts_buffer->timestamp(pkt_index)));
-        memcpy(payload->data(), ts_buffer->packet(pkt_index), num_packets*ts_buffer->packetSize());
-        payload->setNumPackets(num_packets);
+        // The payload is a slot of the carry buffer, a new one is only allocated every CARRY_DATAGRAMS
+        if(!carry_buffer_ || carry_buffer_->packetSize() != ts_buffer->packetSize() || 
+            carry_next_packet_ + ts_packets_per_datagram_ > carry_buffer_->numPacketsCapacity()) {
+            carry_buffer_ = std::make_shared<MPEG2TSBuffer>(CARRY_DATAGRAMS * ts_packets_per_datagram_, ts_buffer->packetSize());
+            carry_buffer_->setNumPackets(carry_buffer_->numPacketsCapacity());
+            carry_next_packet_ = 0;
+        }
+
+        memcpy(carry_buffer_->packet(carry_next_packet_), ts_buffer->packet(pkt_index), num_packets*ts_buffer->packetSize());
+        carry_buffer_->timestamps().append(carry_next_packet_, ts_buffer->timestamp(pkt_index), ts_buffer->timestampRate(pkt_index));
+
+        auto payload = carry_buffer_->makeChild(carry_next_packet_, ts_packets_per_datagram_, num_packets, payload_allocator_);
+        carry_next_packet_ += ts_packets_per_datagram_;
+
+        unfinished_datagram_ = std::allocate_shared<Datagram>(datagram_allocator_, payload, sendTick(ts_buffer->timestamp(pkt_index)));
     }    
 }; // SMPTE2022Part2Encapsulator
 
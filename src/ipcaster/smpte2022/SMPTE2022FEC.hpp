@@ -0,0 +1,404 @@
+//
+// Copyright (C) 2019 Adofo Martinez <adolfo at ipcaster dot net>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#pragma once
+
+#include <stdint.h>
+#include <cstddef>
+#include <string.h>
+#include <deque>
+#include <vector>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <algorithm>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define IPCASTER_XOR_SIMD
+#include <immintrin.h>
+#endif
+
+#include "ipcaster/base/Buffer.hpp"
+#include "ipcaster/base/Logger.hpp"
+#include "ipcaster/base/Exception.hpp"
+#include "ipcaster/net/Datagram.hpp"
+
+namespace ipcaster
+{
+
+/**
+ * XOR of memory blocks (dst ^= src) with the widest SIMD instructions
+ * supported by the CPU, selected once at runtime so no build flags are needed
+ */
+class XORKernel
+{
+public:
+
+    /**
+     * @param dst Block XORed in place
+     * @param src Block XORed into dst
+     * @param size Size of the blocks in bytes
+     */
+    static inline void apply(uint8_t* dst, const uint8_t* src, size_t size)
+    {
+        static const Kernel kernel = select();
+        kernel(dst, src, size);
+    }
+
+private:
+
+    using Kernel = void (*)(uint8_t*, const uint8_t*, size_t);
+
+    static Kernel select()
+    {
+#ifdef IPCASTER_XOR_SIMD
+        __builtin_cpu_init();
+        if(__builtin_cpu_supports("avx2"))
+            return avx2;
+        if(__builtin_cpu_supports("sse2"))
+            return sse2;
+#endif
+        return scalar;
+    }
+
+    static void scalar(uint8_t* dst, const uint8_t* src, size_t size)
+    {
+        size_t i = 0;
+
+        for(; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t)) {
+            uint64_t a, b;
+            memcpy(&a, dst + i, sizeof(a));
+            memcpy(&b, src + i, sizeof(b));
+            a ^= b;
+            memcpy(dst + i, &a, sizeof(a));
+        }
+
+        for(; i < size; i++)
+            dst[i] ^= src[i];
+    }
+
+#ifdef IPCASTER_XOR_SIMD
+    __attribute__((target("sse2")))
+    static void sse2(uint8_t* dst, const uint8_t* src, size_t size)
+    {
+        size_t i = 0;
+
+        for(; i + 16 <= size; i += 16) {
+            auto a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(dst + i));
+            auto b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_xor_si128(a, b));
+        }
+
+        scalar(dst + i, src + i, size - i);
+    }
+
+    __attribute__((target("avx2")))
+    static void avx2(uint8_t* dst, const uint8_t* src, size_t size)
+    {
+        size_t i = 0;
+
+        // 2 registers per iteration, a 1316 bytes payload is 20 iterations
+        for(; i + 64 <= size; i += 64) {
+            auto a0 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(dst + i));
+            auto a1 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(dst + i + 32));
+            auto b0 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+            auto b1 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i + 32));
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), _mm256_xor_si256(a0, b0));
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i + 32), _mm256_xor_si256(a1, b1));
+        }
+
+        sse2(dst + i, src + i, size - i);
+    }
+#endif
+};
+
+/**
+ * Generates the SMPTE 2022-1 FEC of a SMPTE 2022-2 stream.
+ *
+ * The media datagrams are RTP encapsulated (2022-1 receivers identify the lost
+ * datagrams by their sequence numbers) and arranged, row by row, in a matrix of
+ * L columns x D rows. Every column and every row is protected by a FEC packet
+ * with the XOR of its datagrams, so a burst of up to L lost datagrams can be
+ * recovered with the column FEC and scattered losses with the row FEC.
+ *
+ * A row FEC packet is output right after the last datagram of its row. The column
+ * FEC packets are only complete at the end of the matrix, so instead of a burst
+ * they are spread over the time of the next matrix, as the standard recommends.
+ */
+class SMPTE2022Part1FECEncoder
+{
+    using Clock = std::chrono::high_resolution_clock;
+
+public:
+
+    // Kind of the packets output by the encoder
+    enum class Packet { MEDIA, COLUMN_FEC, ROW_FEC };
+
+    static constexpr size_t RTP_HEADER_SIZE = 12;
+
+    static constexpr size_t FEC_HEADER_SIZE = 16;
+
+    // MP2T, RFC 3551
+    static constexpr uint8_t MEDIA_PAYLOAD_TYPE = 33;
+
+    // Dynamic payload type of the FEC packets
+    static constexpr uint8_t FEC_PAYLOAD_TYPE = 96;
+
+    // Max media datagram payload, 7 TS packets of 204 bytes
+    static constexpr size_t MAX_MEDIA_PAYLOAD = 7 * 204;
+
+    /**
+     * Checks a FEC matrix is allowed by SMPTE 2022-1 (L <= 20, 4 <= D <= 20, L x D <= 100)
+     *
+     * @throws std::exception Thrown if it isn't
+     */
+    static void validate(unsigned int columns, unsigned int rows)
+    {
+        if(columns < 1 || columns > 20 || rows < 4 || rows > 20 || columns * rows > 100)
+            throw Exception(std::string("SMPTE2022Part1FECEncoder::validate() - invalid FEC matrix ") + std::to_string(columns) + "x" +
+                std::to_string(rows) + ", SMPTE 2022-1 requires 1 <= L <= 20, 4 <= D <= 20 and L x D <= 100");
+    }
+
+    /** Constructor
+     *
+     * @param columns L, number of columns of the matrix (datagrams per row)
+     *
+     * @param rows D, number of rows of the matrix
+     *
+     * @throws std::exception Thrown if the matrix isn't valid, see validate()
+     */
+    SMPTE2022Part1FECEncoder(unsigned int columns, unsigned int rows)
+        :   columns_(columns),
+            rows_(rows),
+            column_groups_(columns)
+    {
+        validate(columns, rows);
+    }
+
+    /** @returns The ratio of datagrams output per media datagram pushed */
+    double overhead() const { return 1.0 + 1.0 / columns_ + 1.0 / rows_; }
+
+    /**
+     * RTP encapsulates a media datagram and accumulates it in its FEC column and row.
+     *
+     * The packets are output in send tick order: the column FEC packets due before
+     * the datagram, the RTP datagram, and the row FEC if the datagram completes a row
+     *
+     * @param media Media datagram (SMPTE 2022-2 payload)
+     *
+     * @param output Callable with (Packet, std::shared_ptr<Datagram>) receiving the packets
+     *
+     * @throws std::exception Thrown if the datagram is bigger than MAX_MEDIA_PAYLOAD
+     */
+    template<class Output>
+    void push(const std::shared_ptr<Datagram>& media, Output&& output)
+    {
+        auto tick = media->sendTick();
+        auto size = media->payload()->size();
+
+        if(size > MAX_MEDIA_PAYLOAD)
+            throw Exception(fndbg(SMPTE2022Part1FECEncoder) + "datagram of " + std::to_string(size) + " bytes can't be protected");
+
+        releaseColumns(tick, output);
+
+        auto timestamp = rtpTimestamp(tick);
+
+        auto rtp = std::make_shared<Buffer>(RTP_HEADER_SIZE + size);
+        auto packet = static_cast<uint8_t*>(rtp->data());
+        writeRTPHeader(packet, MEDIA_PAYLOAD_TYPE, media_seq_, timestamp);
+        memcpy(packet + RTP_HEADER_SIZE, media->payload()->data(), size);
+        rtp->setSize(RTP_HEADER_SIZE + size);
+
+        auto column = matrix_index_ % columns_;
+        auto row = matrix_index_ / columns_;
+
+        if(matrix_index_ == 0)
+            matrix_start_tick_ = tick;
+        if(column == 0)
+            row_group_.reset(media_seq_);
+        if(row == 0)
+            column_groups_[column].reset(media_seq_);
+
+        row_group_.add(packet + RTP_HEADER_SIZE, size, timestamp);
+        column_groups_[column].add(packet + RTP_HEADER_SIZE, size, timestamp);
+
+        output(Packet::MEDIA, std::make_shared<Datagram>(rtp, tick));
+        media_seq_++;
+
+        if(column == columns_ - 1)
+            output(Packet::ROW_FEC, std::make_shared<Datagram>(fecPacket(row_group_, row_seq_++, true, 1, columns_, timestamp), tick));
+
+        if(++matrix_index_ == columns_ * rows_) {
+            // Spread the column FEC packets over the next matrix
+            auto spacing = (tick - matrix_start_tick_) / columns_;
+
+            for(unsigned int c = 0; c < columns_; c++) {
+                pending_columns_.push_back(std::make_shared<Datagram>(
+                    fecPacket(column_groups_[c], column_seq_++, false, columns_, rows_, timestamp), tick + spacing * (c + 1)));
+            }
+
+            matrix_index_ = 0;
+        }
+    }
+
+    /**
+     * Outputs the column FEC packets still waiting for their send tick.
+     * An incomplete matrix has no FEC
+     */
+    template<class Output>
+    void flush(Output&& output)
+    {
+        releaseColumns(Clock::time_point::max(), output);
+    }
+
+private:
+
+    // XOR of the media datagrams of a column or a row
+    struct Group
+    {
+        // Sequence number of the first datagram
+        uint16_t sn_base = 0;
+
+        // XOR of the payloads lengths
+        uint16_t length_recovery = 0;
+
+        // XOR of the payloads types
+        uint8_t pt_recovery = 0;
+
+        // XOR of the timestamps
+        uint32_t ts_recovery = 0;
+
+        // Size of the biggest payload, the shorter ones are XORed zero padded
+        size_t size = 0;
+
+        // XOR of the payloads
+        std::vector<uint8_t> payload = std::vector<uint8_t>(MAX_MEDIA_PAYLOAD);
+
+        void reset(uint16_t first_seq)
+        {
+            sn_base = first_seq;
+            length_recovery = 0;
+            pt_recovery = 0;
+            ts_recovery = 0;
+            memset(payload.data(), 0, size);
+            size = 0;
+        }
+
+        void add(const uint8_t* data, size_t data_size, uint32_t timestamp)
+        {
+            XORKernel::apply(payload.data(), data, data_size);
+            length_recovery ^= static_cast<uint16_t>(data_size);
+            pt_recovery ^= MEDIA_PAYLOAD_TYPE;
+            ts_recovery ^= timestamp;
+            size = std::max(size, data_size);
+        }
+    };
+
+    // L, number of columns
+    unsigned int columns_;
+
+    // D, number of rows
+    unsigned int rows_;
+
+    // Position of the next datagram in the matrix, row by row
+    unsigned int matrix_index_ = 0;
+
+    // Send tick of the first datagram of the matrix
+    Clock::time_point matrix_start_tick_;
+
+    // Groups of the current matrix
+    std::vector<Group> column_groups_;
+    Group row_group_;
+
+    // Column FEC packets of the previous matrix not output yet, in send tick order
+    std::deque<std::shared_ptr<Datagram>> pending_columns_;
+
+    // RTP sequence numbers of the 3 streams
+    uint16_t media_seq_ = 0;
+    uint16_t column_seq_ = 0;
+    uint16_t row_seq_ = 0;
+
+    /** Outputs the pending column FEC packets due at a send tick */
+    template<class Output>
+    void releaseColumns(const Clock::time_point& tick, Output&& output)
+    {
+        while(!pending_columns_.empty() && pending_columns_.front()->sendTick() <= tick) {
+            output(Packet::COLUMN_FEC, pending_columns_.front());
+            pending_columns_.pop_front();
+        }
+    }
+
+    /** @returns The 90Khz RTP timestamp of a send tick */
+    static uint32_t rtpTimestamp(const Clock::time_point& tick)
+    {
+        auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(tick.time_since_epoch()).count();
+        return static_cast<uint32_t>(static_cast<uint64_t>(ns) * 9 / 100000);
+    }
+
+    static void writeRTPHeader(uint8_t* p, uint8_t payload_type, uint16_t seq, uint32_t timestamp)
+    {
+        p[0] = 0x80; // Version 2, no padding, no extension, no CSRC
+        p[1] = payload_type;
+        p[2] = static_cast<uint8_t>(seq >> 8);
+        p[3] = static_cast<uint8_t>(seq);
+        p[4] = static_cast<uint8_t>(timestamp >> 24);
+        p[5] = static_cast<uint8_t>(timestamp >> 16);
+        p[6] = static_cast<uint8_t>(timestamp >> 8);
+        p[7] = static_cast<uint8_t>(timestamp);
+        memset(p + 8, 0, 4); // SSRC
+    }
+
+    /**
+     * Builds a FEC packet (RTP header, FEC header and XORed payload) of a group
+     *
+     * @param row true for a row FEC (D bit set), false for a column one
+     *
+     * @param offset Distance between the sequence numbers of the group datagrams
+     *
+     * @param na Number of datagrams of the group
+     */
+    static std::shared_ptr<Buffer> fecPacket(const Group& group, uint16_t seq, bool row, unsigned int offset, unsigned int na, uint32_t timestamp)
+    {
+        auto size = RTP_HEADER_SIZE + FEC_HEADER_SIZE + group.size;
+        auto buffer = std::make_shared<Buffer>(size);
+        auto p = static_cast<uint8_t*>(buffer->data());
+
+        writeRTPHeader(p, FEC_PAYLOAD_TYPE, seq, timestamp);
+
+        auto fec = p + RTP_HEADER_SIZE;
+        fec[0] = static_cast<uint8_t>(group.sn_base >> 8);
+        fec[1] = static_cast<uint8_t>(group.sn_base);
+        fec[2] = static_cast<uint8_t>(group.length_recovery >> 8);
+        fec[3] = static_cast<uint8_t>(group.length_recovery);
+        fec[4] = 0x80 | (group.pt_recovery & 0x7F); // E bit, no mask
+        fec[5] = fec[6] = fec[7] = 0;
+        fec[8] = static_cast<uint8_t>(group.ts_recovery >> 24);
+        fec[9] = static_cast<uint8_t>(group.ts_recovery >> 16);
+        fec[10] = static_cast<uint8_t>(group.ts_recovery >> 8);
+        fec[11] = static_cast<uint8_t>(group.ts_recovery);
+        fec[12] = row ? 0x40 : 0x00; // X = 0, D, type = XOR, index = 0
+        fec[13] = static_cast<uint8_t>(offset);
+        fec[14] = static_cast<uint8_t>(na);
+        fec[15] = 0; // SNBase ext bits
+
+        memcpy(fec + FEC_HEADER_SIZE, group.payload.data(), group.size);
+        buffer->setSize(size);
+
+        return buffer;
+    }
+};
+
+}
@@ -54,10 +54,13 @@ public:
      * 
      * @param consumer Reference to the consumer object
      * 
+     * @param parser_args Additional arguments for the FileParser constructor
+     * 
      * @throws std::exception If an error occurs.
      */
-    FileSource(const std::string& file, Consumer& consumer)
-        : parser_(file), processor_(consumer)
+    template<typename... ParserArgs>
+    FileSource(const std::string& file, Consumer& consumer, ParserArgs&&... parser_args)
+        : parser_(file, std::forward<ParserArgs>(parser_args)...), processor_(consumer)
     {
         fifo_ = std::make_unique<FIFO<std::shared_ptr<Buffer>>>(parser_.estimatedBuffersPerSecond());
 
@@ -101,6 +104,7 @@ public:
             throw Exception("FileSource::stop() - not started");
 
         exit_threads_ = true;
+        parser_.unblock();
         fifo_->unblockProducer();
         fifo_->unblockConsumer();
 
@@ -50,9 +50,11 @@ template<>
 class SourceFactory<MPEG2TSFileToUDP>
 {
 public:
-    static std::shared_ptr<MPEG2TSFileToUDP> create(const std::string& file_path, DatagramsMuxer<Timer>::Stream& consumer) 
+    static std::shared_ptr<MPEG2TSFileToUDP> create(const std::string& file_path, DatagramsMuxer<Timer>::Stream& consumer,
+        MPEG2TSFileParser::TimestampMode timestamp_mode = MPEG2TSFileParser::TimestampMode::BITRATE,
+        const MPEG2TSBufferPool::Options& pool_options = MPEG2TSBufferPool::Options()) 
     { 
-        return std::make_shared<MPEG2TSFileToUDP>(file_path, consumer);
+        return std::make_shared<MPEG2TSFileToUDP>(file_path, consumer, timestamp_mode, pool_options, consumer.sendBufferingPreroll());
     }
 };
 
@@ -16,7 +16,10 @@
 
 #include <iostream>
 #include <thread>
+#include <mutex>
+#include <condition_variable>
 
+#include <boost/lockfree/spsc_queue.hpp>
 #include <gtest/gtest.h>
 
 #include "ipcaster/base/FIFO.hpp"
@@ -53,6 +56,8 @@ public:
 
 static const size_t FIFO_CAPACITY = 100;
 static const size_t TEST_PERFORMANCE_ELEMENTS = 1000000;
+static const size_t THROUGHPUT_FIFO_CAPACITY = 4096;
+static const size_t THROUGHPUT_ELEMENTS = 2000000;
 
 TEST_F(FIFOTest, pushTillFull) 
 {
@@ -63,13 +68,18 @@ TEST_F(FIFOTest, pushTillFull)
         fifo.push((int)i);
 
     // This thread waits 1(s) and pop an element
-    std::thread ([&]{
+    std::thread thread_consumer([&]{
         std::this_thread::sleep_for(std::chrono::seconds(1));
         fifo.pop();
-    }).detach();
+    });
 
     // Wait for the thread to pop an element to complete de push
     fifo.push(0);
+
+    thread_consumer.join();
+
+    EXPECT_EQ(fifo.readAvailable(), FIFO_CAPACITY);
+    EXPECT_EQ(fifo.front(), 1);
 }
 
 TEST_F(FIFOTest, popTillEmpty)
@@ -85,13 +95,50 @@ TEST_F(FIFOTest, popTillEmpty)
         fifo.pop();
 
     // This thread waits 1(s) and push an element
-    std::thread ([&]{
+    std::thread thread_producer([&]{
         std::this_thread::sleep_for(std::chrono::seconds(1));
         fifo.push(0);
-    }).detach();
+    });
 
     // Wait for the thread to push an element to be read
-    fifo.waitReadAvailable();
+    EXPECT_EQ(fifo.waitReadAvailable(), 1u);
+
+    thread_producer.join();
+}
+
+// The capacity is not a power of 2, the indexes wrap around the slots many times
+TEST_F(FIFOTest, wrapAround)
+{
+    FIFO<int> fifo(FIFO_CAPACITY);
+
+    int pushed = 0;
+    int popped = 0;
+
+    for(size_t round=0;round<50;round++) {
+        // Leave the FIFO with an increasing number of elements on each round
+        while(fifo.tryPush(pushed))
+            pushed++;
+
+        ASSERT_EQ(fifo.readAvailable(), FIFO_CAPACITY);
+        ASSERT_EQ(fifo.writeAvailable(), 0u);
+
+        for(size_t i=0;i<FIFO_CAPACITY-round;i++) {
+            ASSERT_EQ(fifo.front(), popped);
+            fifo.pop();
+            popped++;
+        }
+
+        ASSERT_EQ(fifo.readAvailable(), round);
+        ASSERT_EQ(fifo.writeAvailable(), FIFO_CAPACITY - round);
+    }
+
+    while(fifo.readAvailable()) {
+        ASSERT_EQ(fifo.front(), popped);
+        fifo.pop();
+        popped++;
+    }
+
+    EXPECT_EQ(popped, pushed);
 }
 
 TEST_F(FIFOTest, testPerformance)
@@ -149,6 +196,142 @@ TEST_F(FIFOTest, testPerformance)
         << std::endl;
 }
 
+/**
+ * Reference for testThroughput, a FIFO that locks a mutex on every push and pop to
+ * signal the other side, as FIFO did before being lock-free
+ */
+template <typename T>
+class MutexFIFO
+{
+public:
+    MutexFIFO(size_t capacity) 
+        :   queue_(capacity)
+    {
+    }
+
+    void push(const T& element)
+    {
+        if(!queue_.push(element)) {
+            std::unique_lock<std::mutex> lock_full(mutex_full_);
+
+            while(!queue_.push(element)) {
+                producer_is_waiting_ = true;
+                condition_full_.wait(lock_full);
+            }
+        }
+
+        std::lock_guard<std::mutex> lock_empty(mutex_empty_);
+
+        if(consumer_is_waiting_) {
+            consumer_is_waiting_ = false;
+            condition_empty_.notify_one();
+        }
+    }
+
+    T& front() { return queue_.front(); }
+
+    void pop()
+    {
+        queue_.pop();
+
+        std::lock_guard<std::mutex> lock_full(mutex_full_);
+
+        if(producer_is_waiting_) {
+            producer_is_waiting_ = false;
+            condition_full_.notify_one();
+        }
+    }
+
+    size_t waitReadAvailable()
+    {
+        size_t pop_available = queue_.read_available();
+
+        if(!pop_available) { 
+            std::unique_lock<std::mutex> lock_empty(mutex_empty_);
+
+            while(!(pop_available = queue_.read_available())) {
+                consumer_is_waiting_ = true;
+                condition_empty_.wait(lock_empty);
+            }
+        }
+
+        return pop_available;
+    }
+
+private:
+    boost::lockfree::spsc_queue<T> queue_;
+
+    bool producer_is_waiting_ = false;
+    bool consumer_is_waiting_ = false;
+
+    std::mutex mutex_full_;
+    std::condition_variable condition_full_;
+
+    std::mutex mutex_empty_;
+    std::condition_variable condition_empty_;
+};
+
+// Size of a muxer datagram descriptor
+struct ThroughputElement
+{
+    uint64_t index;
+    uint64_t padding[4];
+};
+
+/** 
+ * Moves THROUGHPUT_ELEMENTS from a producer to a consumer thread
+ * @returns The throughput in Melements/s
+ */
+template <typename Queue>
+double measureThroughput(Queue& fifo, size_t& errors)
+{
+    auto t_begin = std::chrono::high_resolution_clock::now();
+
+    std::thread thread_producer([&]{  
+        for(uint64_t i=0;i<THROUGHPUT_ELEMENTS;i++)
+            fifo.push({i, {}});
+    });
+
+    std::thread thread_consumer([&]{  
+        for(uint64_t i=0;i<THROUGHPUT_ELEMENTS;i++) {
+            fifo.waitReadAvailable();
+            if(fifo.front().index != i)
+                errors++;
+            fifo.pop();
+        }
+    });
+
+    thread_producer.join();
+    thread_consumer.join();
+
+    auto t_delta = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::high_resolution_clock::now() - t_begin).count();
+
+    return THROUGHPUT_ELEMENTS * 1000.0 / t_delta;
+}
+
+// Sustained rate with the FIFO mostly neither full nor empty, as the muxer streams FIFOs,
+// against the mutex signaled FIFO
+TEST_F(FIFOTest, testThroughput)
+{
+    size_t errors = 0;
+    size_t reference_errors = 0;
+
+    FIFO<ThroughputElement> fifo(THROUGHPUT_FIFO_CAPACITY);
+    MutexFIFO<ThroughputElement> reference(THROUGHPUT_FIFO_CAPACITY);
+
+    auto throughput = measureThroughput(fifo, errors);
+    auto reference_throughput = measureThroughput(reference, reference_errors);
+
+    EXPECT_EQ(errors, 0u);
+    EXPECT_EQ(reference_errors, 0u);
+
+    LOG << "Throughput " << throughput << "(Melements/s), mutex signaled FIFO " << reference_throughput 
+        << "(Melements/s), speedup " << throughput / reference_throughput << std::endl;
+
+    // The lock-free FIFO never takes a lock while neither full nor empty
+    EXPECT_GT(throughput, reference_throughput);
+}
+
 TEST_F(FIFOTest, testUnblock)
 {
     FIFO<int> fifo(FIFO_CAPACITY);
@@ -168,6 +351,9 @@ TEST_F(FIFOTest, testUnblock)
 
     thread_producer.join();
 
+    // The push unblocked didn't overwrite the FIFO
+    EXPECT_EQ(fifo.readAvailable(), FIFO_CAPACITY);
+
     fifo.clear();
 
     LOG << "[threadMain] FIFO is empty" << std::endl;
@@ -182,6 +368,8 @@ TEST_F(FIFOTest, testUnblock)
     LOG << "[threadMain] unblockConsumer" << std::endl;
     fifo.unblockConsumer();
     thread_consumer.join();
+
+    EXPECT_EQ(fifo.readAvailable(), 0u);
 }
 
 } // namespace
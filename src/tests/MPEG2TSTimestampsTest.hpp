@@ -0,0 +1,144 @@
+//
+// Copyright (C) 2019 Adofo Martinez <adolfo at ipcaster dot net>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include <string>
+#include <vector>
+
+#include <ipcaster/mpeg2-ts/MPEG2TSFileParser.hpp>
+#include <ipcaster/base/Exception.hpp>
+
+namespace ipcaster {
+
+/**
+ * Checks the segments model of the buffer timestamps against timestamps computed
+ * per packet, in bitrate and PCR modes
+ */
+class MPEG2TSTimestampsTest
+{
+public:
+
+    MPEG2TSTimestampsTest(const std::string& file)
+        :   file_(file)
+    {
+    }
+
+    int run()
+    {
+        testSegments();
+        testFile(MPEG2TSFileParser::TimestampMode::BITRATE);
+        testFile(MPEG2TSFileParser::TimestampMode::PCR);
+
+        printf("[MPEG2TSTimestampsTest] Test OK.\n");
+
+        return 0;
+    }
+
+private:
+
+    // Max difference of the fixed point model with the per packet computation, in 27MHz ticks
+    static const uint64_t MAX_ERROR = 1;
+
+    std::string file_;
+
+    /** A segment per datagram of a carry buffer, most of them in the overflow */
+    void testSegments()
+    {
+        const size_t SEGMENTS = 60;
+        const size_t PACKETS_PER_SEGMENT = 7;
+
+        MPEG2TSTimestamps timestamps;
+
+        if(timestamps.at(0) != 0 || timestamps.rate(0) != 0)
+            throw Exception("[MPEG2TSTimestampsTest] timestamps without segments");
+
+        for(size_t s = 0; s < SEGMENTS; s++)
+            timestamps.append(s * PACKETS_PER_SEGMENT, 1000000 * s, MPEG2TSTimestamps::toRate(100.0 + s));
+
+        for(size_t index = 0; index < SEGMENTS * PACKETS_PER_SEGMENT + 10; index++) {
+            auto s = std::min(index / PACKETS_PER_SEGMENT, SEGMENTS - 1);
+            auto expected = 1000000 * s + (index - s * PACKETS_PER_SEGMENT) * (100 + s);
+
+            if(timestamps.at(index) != expected || timestamps.rate(index) != MPEG2TSTimestamps::toRate(100.0 + s))
+                throw Exception("[MPEG2TSTimestampsTest] wrong segment of packet " + std::to_string(index));
+        }
+    }
+
+    /** Timestamps the file with the parser and computes them again per packet */
+    void testFile(MPEG2TSFileParser::TimestampMode mode)
+    {
+        bool pcr_mode = mode == MPEG2TSFileParser::TimestampMode::PCR;
+
+        MPEG2TSFileParser parser(file_, mode);
+
+        std::vector<uint64_t> timestamps;
+
+        // Packet index and PCR of the packets of the first PCR PID
+        std::vector<std::pair<size_t, uint64_t>> pcrs;
+        int pcr_pid = -1;
+
+        while(auto buffer = parser.read()) {
+            TSPacket packet(buffer->packet(0), buffer->packetSize());
+            for(size_t i = 0; i < buffer->numPackets(); i++, packet.moveNext()) {
+                if(packet.hasPCR() && (pcr_pid < 0 || packet.pid() == pcr_pid)) {
+                    pcr_pid = packet.pid();
+                    pcrs.push_back({timestamps.size(), packet.pcr()});
+                }
+
+                timestamps.push_back(buffer->timestamp(i));
+            }
+        }
+
+        if(pcrs.size() < 2)
+            throw Exception("[MPEG2TSTimestampsTest] the file needs at least two PCRs");
+
+        double cbr_ticks_per_packet = 188 * 8 * PCRCLOCKFREQUENCY / static_cast<double>(parser.estimatedBitrate());
+
+        // PCR mode, the first PCR is timed at the file bitrate and the next ones at their distance to it
+        std::vector<uint64_t> pcr_timestamps = { static_cast<uint64_t>(pcrs[0].first * cbr_ticks_per_packet) };
+        for(size_t p = 1; p < pcrs.size(); p++)
+            pcr_timestamps.push_back(pcr_timestamps.back() + pcrSub(pcrs[p - 1].second, pcrs[p].second));
+
+        uint64_t max_error = 0;
+        size_t p = 0;
+
+        for(size_t index = 0; index < timestamps.size(); index++) {
+            uint64_t expected;
+
+            if(!pcr_mode || index <= pcrs[0].first)
+                expected = static_cast<uint64_t>(index * cbr_ticks_per_packet);
+            else {
+                // Interpolated between the PCRs around the packet, extrapolated after the last one
+                while(p + 2 < pcrs.size() && pcrs[p + 1].first < index)
+                    p++;
+
+                double ticks_per_packet = static_cast<double>(pcr_timestamps[p + 1] - pcr_timestamps[p]) / (pcrs[p + 1].first - pcrs[p].first);
+                expected = static_cast<uint64_t>(pcr_timestamps[p] + (index - pcrs[p].first) * ticks_per_packet);
+            }
+
+            auto error = timestamps[index] > expected ? timestamps[index] - expected : expected - timestamps[index];
+            max_error = std::max(max_error, error);
+
+            if(error > MAX_ERROR)
+                throw Exception("[MPEG2TSTimestampsTest] " + std::string(pcr_mode ? "PCR" : "bitrate") + " mode timestamp of packet "
+                    + std::to_string(index) + " is " + std::to_string(timestamps[index]) + ", expected " + std::to_string(expected));
+        }
+
+        printf("[MPEG2TSTimestampsTest] %s mode %zu packets, max error %llu ticks\n", pcr_mode ? "PCR" : "bitrate",
+            timestamps.size(), static_cast<unsigned long long>(max_error));
+    }
+};
+
+} // namespace
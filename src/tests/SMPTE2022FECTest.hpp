@@ -0,0 +1,189 @@
+//
+// Copyright (C) 2019 Adofo Martinez <adolfo at ipcaster dot net>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include <map>
+#include <set>
+#include <vector>
+#include <random>
+
+#include <ipcaster/smpte2022/SMPTE2022FEC.hpp>
+#include <ipcaster/base/Exception.hpp>
+
+namespace ipcaster {
+
+/**
+ * Loss injection test of the SMPTE 2022-1 FEC: encodes a stream, drops media
+ * datagrams and recovers them from the column and row FEC packets
+ */
+class SMPTE2022FECTest
+{
+public:
+
+    SMPTE2022FECTest(unsigned int columns, unsigned int rows)
+        :   columns_(columns),
+            rows_(rows)
+    {
+    }
+
+    int run()
+    {
+        using Packet = SMPTE2022Part1FECEncoder::Packet;
+
+        SMPTE2022Part1FECEncoder encoder(columns_, rows_);
+        std::mt19937 random(2022);
+
+        const size_t matrices = 4;
+        const size_t datagrams = columns_ * rows_ * matrices;
+
+        std::chrono::high_resolution_clock::time_point last_tick;
+
+        auto output = [&](Packet type, const std::shared_ptr<Datagram>& datagram) {
+            if(datagram->sendTick() < last_tick)
+                throw Exception("[SMPTE2022FECTest] packets not output in send tick order");
+            last_tick = datagram->sendTick();
+
+            auto p = static_cast<uint8_t*>(datagram->payload()->data());
+            std::vector<uint8_t> packet(p, p + datagram->payload()->size());
+
+            if(type == Packet::MEDIA)
+                media_[seq(packet)] = packet;
+            else
+                fec_.push_back(packet);
+        };
+
+        for(size_t i = 0; i < datagrams; i++) {
+            // Full datagrams with a few shorter ones, as the last one of a file
+            size_t size = (i % 13 == 5 ? 1 + i % 7 : 7) * 188;
+
+            auto payload = std::make_shared<Buffer>(size);
+            for(size_t b = 0; b < size; b++)
+                static_cast<uint8_t*>(payload->data())[b] = static_cast<uint8_t>(random());
+            payload->setSize(size);
+
+            encoder.push(std::make_shared<Datagram>(payload, std::chrono::high_resolution_clock::time_point(std::chrono::microseconds(1000 * i))), output);
+        }
+
+        encoder.flush(output);
+
+        if(media_.size() != datagrams || fec_.size() != matrices * (columns_ + rows_))
+            throw Exception("[SMPTE2022FECTest] unexpected number of packets");
+
+        auto received = media_;
+
+        // Burst of L datagrams in the first matrix, recovered by the column FEC
+        for(size_t i = 3; i < 3 + columns_; i++)
+            received.erase(static_cast<uint16_t>(i));
+
+        // A datagram per row in the second matrix, recovered by the row FEC
+        for(size_t r = 0; r < rows_; r++)
+            received.erase(static_cast<uint16_t>(columns_ * rows_ + r * columns_ + (r * 3) % columns_));
+
+        // Losses in the third matrix that need both: (0,0) by its row, then (1,0) 
+        // by its column, then (1,1) by its row
+        auto third = 2 * columns_ * rows_;
+        received.erase(static_cast<uint16_t>(third));
+        received.erase(static_cast<uint16_t>(third + columns_));
+        received.erase(static_cast<uint16_t>(third + columns_ + 1));
+
+        auto lost = media_.size() - received.size();
+
+        recover(received);
+
+        if(received != media_)
+            throw Exception("[SMPTE2022FECTest] recovery failed");
+
+        printf("[SMPTE2022FECTest] %ux%u FEC recovered %zu lost datagrams of %zu\n", columns_, rows_, lost, datagrams);
+        printf("[SMPTE2022FECTest] Test OK.\n");
+
+        return 0;
+    }
+
+private:
+
+    unsigned int columns_;
+
+    unsigned int rows_;
+
+    // RTP media datagrams by sequence number
+    std::map<uint16_t, std::vector<uint8_t>> media_;
+
+    // Column and row FEC packets
+    std::vector<std::vector<uint8_t>> fec_;
+
+    static uint16_t seq(const std::vector<uint8_t>& packet) { return static_cast<uint16_t>(packet[2] << 8 | packet[3]); }
+
+    /** Recovers the missing datagrams while some FEC packet protects a single missing one */
+    void recover(std::map<uint16_t, std::vector<uint8_t>>& received)
+    {
+        const size_t RTP = SMPTE2022Part1FECEncoder::RTP_HEADER_SIZE;
+        const size_t FEC = SMPTE2022Part1FECEncoder::FEC_HEADER_SIZE;
+
+        bool progress = true;
+
+        while(progress) {
+            progress = false;
+
+            for(auto& fec : fec_) {
+                const uint8_t* header = &fec[RTP];
+                uint16_t sn_base = static_cast<uint16_t>(header[0] << 8 | header[1]);
+                uint16_t offset = header[13];
+                uint16_t na = header[14];
+
+                std::vector<uint16_t> missing;
+                for(uint16_t i = 0; i < na; i++) {
+                    if(!received.count(static_cast<uint16_t>(sn_base + i * offset)))
+                        missing.push_back(static_cast<uint16_t>(sn_base + i * offset));
+                }
+
+                if(missing.size() != 1)
+                    continue;
+
+                uint16_t length = static_cast<uint16_t>(header[2] << 8 | header[3]);
+                uint8_t pt = header[4] & 0x7F;
+                uint32_t ts = static_cast<uint32_t>(header[8]) << 24 | header[9] << 16 | header[10] << 8 | header[11];
+                std::vector<uint8_t> payload(fec.begin() + RTP + FEC, fec.end());
+
+                for(uint16_t i = 0; i < na; i++) {
+                    auto it = received.find(static_cast<uint16_t>(sn_base + i * offset));
+                    if(it == received.end())
+                        continue;
+
+                    auto& packet = it->second;
+                    length ^= static_cast<uint16_t>(packet.size() - RTP);
+                    pt ^= packet[1] & 0x7F;
+                    ts ^= static_cast<uint32_t>(packet[4]) << 24 | packet[5] << 16 | packet[6] << 8 | packet[7];
+                    XORKernel::apply(payload.data(), &packet[RTP], packet.size() - RTP);
+                }
+
+                std::vector<uint8_t> packet(RTP + length);
+                packet[0] = 0x80;
+                packet[1] = pt;
+                packet[2] = static_cast<uint8_t>(missing[0] >> 8);
+                packet[3] = static_cast<uint8_t>(missing[0]);
+                packet[4] = static_cast<uint8_t>(ts >> 24);
+                packet[5] = static_cast<uint8_t>(ts >> 16);
+                packet[6] = static_cast<uint8_t>(ts >> 8);
+                packet[7] = static_cast<uint8_t>(ts);
+                memcpy(&packet[RTP], payload.data(), length);
+
+                received[missing[0]] = packet;
+                progress = true;
+            }
+        }
+    }
+};
+
+} // namespace
@@ -18,10 +18,15 @@
 #include <thread>
 #include <future>
 
-//#include <gtest/gtest.h>
+#ifdef IPCASTER_GTEST
+#include <gtest/gtest.h>
+
+#include "FIFOTest.hpp"
+#endif
 
-//#include "FIFOTest.hpp"
 #include "SendReceiveTest.hpp"
+#include "SMPTE2022FECTest.hpp"
+#include "MPEG2TSTimestampsTest.hpp"
 
 #ifdef _MSC_VER // Windows
 
@@ -39,10 +44,17 @@
 
 int main(int argc, char* argv[])
 {
-    //testing::InitGoogleTest(&argc, argv);
-    //return RUN_ALL_TESTS();
+#ifdef IPCASTER_GTEST
+    testing::InitGoogleTest(&argc, argv);
+    if(RUN_ALL_TESTS())
+        return 1;
+#endif
 
     try {
+        ipcaster::SMPTE2022FECTest(10, 10).run();
+        ipcaster::SMPTE2022FECTest(5, 4).run();
+        ipcaster::MPEG2TSTimestampsTest(SOURCE_TS).run();
+
         ipcaster::SendReceiveTest send_receive_test(50000, SOURCE_TS, "out.ts");
 
         auto future_ipcaster = std::async(std::launch::async, [&] () { 